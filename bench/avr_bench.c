@@ -0,0 +1,172 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file avr_bench.c
+ * \brief AVR firmware measuring the library in cycles.
+ *
+ * Runs under tools/simavr_bench.c, or on a board with the reader
+ * on USART1. Timer1 counts the cpu cycles, the results are printed
+ * on USART0 as the host benchmarks:
+ * bench <name> <value> <unit>
+ *
+ * At the end the cpu sleeps with the interrupts disabled, which
+ * stops simavr.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include "hal.h"
+#include "rfid_m5.h"
+#include "rfid_m5_private.h"
+
+#define SIZE 64
+
+/*! Timer1 overflows, the high word of the cycles */
+static volatile uint16_t ovf;
+
+ISR(TIMER1_OVF_vect)
+{
+	ovf++;
+}
+
+/*! cpu cycles since the start of timer1. */
+static uint32_t cycles(void)
+{
+	uint16_t lo, hi;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		lo = TCNT1;
+		hi = ovf;
+
+		/* overflow not served yet */
+		if ((TIFR1 & _BV(TOV1)) && (lo < 0x8000))
+			hi++;
+	}
+
+	return(((uint32_t)hi << 16) | lo);
+}
+
+static void report(const char *name, const uint32_t value,
+		const char *unit)
+{
+	char s[48];
+
+	snprintf(s, sizeof(s), "bench %s %lu %s\r\n", name,
+			(unsigned long)value, unit);
+	usart_printstr(0, s);
+}
+
+int main(void)
+{
+	static uint8_t data[SIZE];
+	struct cbuffer_t *cb;
+	uint32_t t, zero;
+	uint16_t crc;
+	uint8_t i, d[RFID_SIZE];
+
+	TCCR1A = 0;
+	TCCR1B = _BV(CS10);
+	TIMSK1 = _BV(TOIE1);
+	usart_init(0);
+	usart_resume(0);
+	rfid_init();
+	sei();
+
+	for (i = 0; i < SIZE; i++)
+		data[i] = i * 37;
+
+	/* cost of the measure itself */
+	t = cycles();
+	zero = cycles() - t;
+
+	t = cycles();
+	crc = 0xffff;
+
+	for (i = 0; i < SIZE; i++)
+		CRC_calcCrc8(&crc, data[i]);
+
+	report("avr_crc_bitwise", (cycles() - t - zero) / SIZE, "cycles/byte");
+	t = cycles();
+
+	for (i = 0; i < SIZE; i++)
+		crc = M5_CRC_STEP(crc, data[i]);
+
+	report("avr_crc_bytewise", (cycles() - t - zero) / SIZE, "cycles/byte");
+
+	cb = cbuffer_init();
+	t = cycles();
+
+	for (i = 0; i < SIZE; i++)
+		cbuffer_push(cb, data[i]);
+
+	report("avr_cbuffer_push", (cycles() - t - zero) / SIZE, "cycles/byte");
+	t = cycles();
+	cbuffer_pop(cb, data, SIZE);
+	report("avr_cbuffer_pop", (cycles() - t - zero) / SIZE, "cycles/byte");
+	cbuffer_shut(cb);
+
+	/* a reply of SIZE - 7 data bytes */
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+	data[0] = 0xff;
+	data[1] = SIZE - 7;
+	data[2] = 0x22;
+	data[3] = 0;
+	data[4] = 0;
+	crc = 0xffff;
+
+	for (i = 1; i < (SIZE - 2); i++)
+		CRC_calcCrc8(&crc, data[i]);
+
+	data[SIZE - 2] = (uint8_t)(crc >> 8);
+	data[SIZE - 1] = (uint8_t)(crc & 0xff);
+	rx_reset();
+	t = cycles();
+
+	for (i = 0; i < SIZE; i++)
+		rx_byte(data[i]);
+
+	report("avr_parser", (cycles() - t - zero) / SIZE, "cycles/byte");
+	report("avr_parser_ok", rfid->error == RX_END, "bool");
+	free(rfid->data);
+
+	/* commands, with the peer on USART1 */
+	t = cycles();
+	report("avr_resume_err", rfid_resume(), "status");
+	report("avr_resume", cycles() - t - zero, "cycles");
+	t = cycles();
+	report("avr_read_ok", rfid_read(d), "bool");
+	report("avr_read", cycles() - t - zero, "cycles");
+	t = cycles();
+	report("avr_inventory_tags", rfid_inventory(0), "tags");
+	report("avr_inventory", cycles() - t - zero, "cycles");
+
+	/* wait for the last byte, then stop */
+	while (!usart_txready(0))
+		;
+
+	hal_delay_ms(5);
+	cli();
+	sleep_enable();
+	sleep_cpu();
+	return(0);
+}
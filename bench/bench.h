@@ -0,0 +1,60 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file bench.h
+ * \brief Helpers of the host benchmarks.
+ *
+ * Every result is printed on a line:
+ * bench <name> <value> <unit>
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/*! Monotonic time in nsec. */
+static inline uint64_t bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*! Print a result. */
+static inline void bench_report(const char *name, const double value,
+		const char *unit)
+{
+	printf("bench %s %.3f %s\n", name, value, unit);
+}
+
+/*! Written by bench_keep() */
+static volatile uint32_t bench_sink;
+
+/*! Keep a value alive, the compiler can not drop its calculation. */
+static inline void bench_keep(const uint32_t value)
+{
+	bench_sink = value;
+}
+
+#endif
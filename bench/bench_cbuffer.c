@@ -0,0 +1,102 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file bench_cbuffer.c
+ * \brief bytes/s of the circular buffer.
+ *
+ * The bytes are pushed and popped in bursts of different size,
+ * the share of pushes taking the wrap and overflow branches is
+ * reported with every burst size.
+ */
+
+#include "bench.h"
+#include <stdlib.h>
+#include "circular_buffer.h"
+
+#define BYTES 20000000UL
+
+/*! Push and pop burst bytes at a time. */
+static void burst(struct cbuffer_t *cb, const uint8_t size)
+{
+	uint8_t out[255];
+	uint32_t n, wraps, rejects;
+	uint64_t t;
+	uint8_t i;
+	char name[32];
+
+	cbuffer_clear(cb);
+	wraps = 0;
+	rejects = 0;
+	t = bench_ns();
+
+	for (n = 0; n < BYTES; n += size) {
+		for (i = 0; i < size; i++)
+			if (!cbuffer_push(cb, (char)i))
+				rejects++;
+			else if (!cb->idx)
+				wraps++;
+
+		bench_keep(cbuffer_pop(cb, out, sizeof(out)));
+	}
+
+	t = bench_ns() - t;
+	snprintf(name, sizeof(name), "cbuffer_burst%u", size);
+	bench_report(name, (double)BYTES * 1e9 / t, "bytes/s");
+	snprintf(name, sizeof(name), "cbuffer_burst%u_wrap", size);
+	bench_report(name, (double)wraps / BYTES, "ratio");
+	snprintf(name, sizeof(name), "cbuffer_burst%u_overflow", size);
+	bench_report(name, (double)rejects / BYTES, "ratio");
+}
+
+/*! Messages of 16 bytes popped with cbuffer_popm(). */
+static void messages(struct cbuffer_t *cb)
+{
+	uint8_t out[255];
+	uint64_t t;
+	uint32_t n;
+	uint8_t i;
+
+	cbuffer_clear(cb);
+	t = bench_ns();
+
+	for (n = 0; n < BYTES; n += 16) {
+		for (i = 0; i < 15; i++)
+			cbuffer_push(cb, 'a' + i);
+
+		cbuffer_push(cb, '\n');
+		bench_keep(cbuffer_popm(cb, out, sizeof(out), '\n'));
+	}
+
+	t = bench_ns() - t;
+	bench_report("cbuffer_popm16", (double)BYTES * 1e9 / t, "bytes/s");
+}
+
+int main(void)
+{
+	struct cbuffer_t *cb;
+
+	cb = cbuffer_init();
+	burst(cb, 1);
+	burst(cb, 16);
+	burst(cb, 128);
+	/* the whole buffer, every burst ends in the overflow state */
+	burst(cb, 255);
+	messages(cb);
+	cbuffer_shut(cb);
+	return(EXIT_SUCCESS);
+}
@@ -0,0 +1,94 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file bench_crc.c
+ * \brief ns/byte of the CRC variants.
+ *
+ * - bitwise: CRC_calcCrc8(), the one of the parser.
+ * - frame: m5_crc() on the rfid struct, as used on every frame.
+ * - bytewise: M5_CRC_STEP(), the compile time encoder at runtime.
+ */
+
+#include "bench.h"
+#include <stdlib.h>
+#include "rfid_m5.h"
+#include "rfid_m5_private.h"
+
+#define SIZE 250
+#define LOOPS 20000
+
+
+int main(void)
+{
+	uint8_t data[SIZE];
+	uint64_t t;
+	uint16_t crc, ref;
+	uint32_t i, j;
+
+	for (i = 0; i < SIZE; i++)
+		data[i] = rand();
+
+	t = bench_ns();
+
+	for (j = 0; j < LOOPS; j++) {
+		crc = 0xffff;
+
+		for (i = 0; i < SIZE; i++)
+			CRC_calcCrc8(&crc, data[i]);
+
+		bench_keep(crc);
+	}
+
+	bench_report("crc_bitwise", (double)(bench_ns() - t) / LOOPS / SIZE,
+			"ns/byte");
+	ref = crc;
+
+	t = bench_ns();
+
+	for (j = 0; j < LOOPS; j++) {
+		crc = 0xffff;
+
+		for (i = 0; i < SIZE; i++)
+			crc = M5_CRC_STEP(crc, data[i]);
+
+		bench_keep(crc);
+	}
+
+	bench_report("crc_bytewise", (double)(bench_ns() - t) / LOOPS / SIZE,
+			"ns/byte");
+
+	if (crc != ref) {
+		fprintf(stderr, "crc_bytewise mismatch %04x %04x\n", crc, ref);
+		return(EXIT_FAILURE);
+	}
+
+	rfid = malloc(sizeof(struct rfid_t));
+	rfid->data = data + 2;
+	rfid->len = SIZE - 2;
+	rfid->opcode = 0x29;
+	rfid->status = 0;
+	t = bench_ns();
+
+	for (j = 0; j < LOOPS; j++)
+		bench_keep(m5_crc(TRUE));
+
+	bench_report("crc_frame", (double)(bench_ns() - t) / LOOPS / (SIZE + 2),
+			"ns/byte");
+	free(rfid);
+	return(EXIT_SUCCESS);
+}
@@ -0,0 +1,374 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file bench_e2e.c
+ * \brief End to end latency and throughput against the emulator.
+ *
+ * For every baud rate, tag population and inventory time a
+ * m5e_emu is started on a pty and the full stack is run on it:
+ *
+ * - resume, rfid_resume() on a just booted reader.
+ * - ttft, from the resume to the first tag read.
+ * - read_p50, read_p90, read_p99, read_max, round trip of
+ *   rfid_read_tag(), the reads with a tag only.
+ * - read_fail, the reads without a tag, not in the percentiles.
+ * - inv_p50, inv_max, round trip of rfid_round() with the
+ *   inventory time fixed: inventory, tag buffer fetches until it
+ *   is empty and clear.
+ * - tags, tag reads per second over the inventory rounds, the
+ *   read counts of the tags.
+ * - unique, unique tags per second over the same rounds, up to
+ *   UNIQUE_SIZE tags.
+ * - unique_ms, from the first round to the last new tag seen.
+ *
+ * The exit status is a failure if a resume failed.
+ *
+ * Every result name carries the setting: e2e_<result>_b<baud>_
+ * n<tags>_t<msec>.
+ *
+ * $ bench_e2e [-x m5e_emu] [-b baud,..] [-n tags,..] [-t msec,..]
+ *   [-r reads] [-d msec]
+ *
+ * -x the emulator (default build/m5e_emu)
+ * -b baud rates (default 9600,115200)
+ * -n tags in the field (default 1,20,100)
+ * -t inventory time in msec (default 50,200)
+ * -r single reads timed (default 50)
+ * -d duration of the inventory rounds in msec (default 2000)
+ */
+
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "hal.h"
+#include "rfid_m5.h"
+
+/*! Max settings of every list */
+#define LIST_SIZE 8
+/*! Max single reads */
+#define READ_SIZE 1000
+/*! Max inventory rounds timed */
+#define ROUND_SIZE 1000
+/*! Max unique tags tracked */
+#define UNIQUE_SIZE 256
+/*! Max tags of a round */
+#define ROUND_TAGS 255
+
+/*! The pty symlink of the emulator */
+static char link_path[64];
+
+/*! A list of settings from a,b,c */
+static uint8_t list_parse(char *s, uint32_t *list)
+{
+	uint8_t n;
+
+	n = 0;
+
+	for (s = strtok(s, ","); s && (n < LIST_SIZE); s = strtok(NULL, ","))
+		list[n++] = strtoul(s, NULL, 10);
+
+	return(n);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x, y;
+
+	x = *(const uint64_t *)a;
+	y = *(const uint64_t *)b;
+	return((x > y) - (x < y));
+}
+
+/*! The pct percentile of n sorted samples. */
+static uint64_t percentile(const uint64_t *v, const uint32_t n,
+		const uint8_t pct)
+{
+	if (!n)
+		return(0);
+
+	return(v[(n - 1) * pct / 100]);
+}
+
+/*! Report a result of a setting, nsec in msec. */
+static void report(const char *name, const uint32_t *set,
+		const double value, const char *unit)
+{
+	char s[64];
+
+	snprintf(s, sizeof(s), "e2e_%s_b%u_n%u_t%u", name, set[0], set[1],
+			set[2]);
+	bench_report(s, value, unit);
+}
+
+static void emu_stop(const pid_t pid)
+{
+	if (pid > 0) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+
+	unlink(link_path);
+}
+
+/*! Start the emulator, wait for its pty.
+ *
+ * \return the pid, -1 on error.
+ */
+static pid_t emu_start(const char *emu, const uint32_t baud,
+		const uint32_t tags)
+{
+	char b[16], n[16];
+	pid_t pid;
+	uint8_t i;
+	int fd;
+
+	unlink(link_path);
+	snprintf(b, sizeof(b), "%u", baud);
+	snprintf(n, sizeof(n), "%u", tags);
+	pid = fork();
+
+	if (!pid) {
+		/* the emulator prints the pty name */
+		fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		execl(emu, emu, "-b", b, "-n", n, "-L", link_path,
+				(char *)NULL);
+		perror(emu);
+		_exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; (pid > 0) && (i < 100); i++) {
+		if (!access(link_path, F_OK))
+			return(pid);
+
+		hal_delay_ms(10);
+	}
+
+	emu_stop(pid);
+	return(-1);
+}
+
+/*! Add the EPC to the unique ones.
+ *
+ * \return TRUE a new tag, FALSE already seen or the table is full.
+ */
+static uint8_t unique_add(uint8_t (*unique)[RFID_EPC_SIZE],
+		uint16_t *count, const struct rfid_tag_t *tag)
+{
+	uint8_t epc[RFID_EPC_SIZE];
+	uint16_t i;
+
+	memset(epc, 0, RFID_EPC_SIZE);
+	memcpy(epc, tag->epc, tag->epc_len);
+
+	for (i = 0; i < *count; i++)
+		if (!memcmp(unique[i], epc, RFID_EPC_SIZE))
+			return(FALSE);
+
+	if (*count == UNIQUE_SIZE)
+		return(FALSE);
+
+	memcpy(unique[(*count)++], epc, RFID_EPC_SIZE);
+	return(TRUE);
+}
+
+/*! Run the stack on an emulator with the setting.
+ *
+ * \param set baud, tags and inventory msec.
+ * \return FALSE the stack did not start.
+ */
+static uint8_t run(const uint32_t *set, const uint16_t reads,
+		const uint32_t duration, uint64_t *lat)
+{
+	static uint8_t unique[UNIQUE_SIZE][RFID_EPC_SIZE];
+	static struct rfid_tag_t round[ROUND_TAGS];
+	struct rfid_tag_t tag;
+	uint64_t t0, t, start, last;
+	uint32_t total, n, i, fail;
+	uint16_t count;
+	uint8_t found;
+
+	if (!usart_device(RFID_USART_PORT, link_path, set[0])) {
+		report("fail", set, 1, "baud");
+		return(FALSE);
+	}
+
+	rfid_init();
+	t0 = bench_ns();
+
+	if (rfid_resume()) {
+		report("fail", set, 1, "resume");
+		rfid_shut();
+		return(FALSE);
+	}
+
+	report("resume", set, (bench_ns() - t0) / 1e6, "ms");
+
+	/* no tag in the field, the reads would time the timeout */
+	if (set[1]) {
+		for (i = 0; (i < 100) && !rfid_read_tag(&tag); i++);
+
+		if (i < 100)
+			report("ttft", set, (bench_ns() - t0) / 1e6, "ms");
+	}
+
+	n = 0;
+	fail = 0;
+
+	for (i = 0; set[1] && (i < reads); i++) {
+		t = bench_ns();
+
+		if (rfid_read_tag(&tag))
+			lat[n++] = bench_ns() - t;
+		else
+			fail++;
+	}
+
+	if (set[1] && reads)
+		report("read_fail", set, fail, "reads");
+
+	if (n) {
+		qsort(lat, n, sizeof(uint64_t), cmp_u64);
+		report("read_p50", set, percentile(lat, n, 50) / 1e6, "ms");
+		report("read_p90", set, percentile(lat, n, 90) / 1e6, "ms");
+		report("read_p99", set, percentile(lat, n, 99) / 1e6, "ms");
+		report("read_max", set, percentile(lat, n, 100) / 1e6, "ms");
+	}
+
+	/* the inventory time of the setting, not adapted */
+	rfid_metadata(RFID_META_COUNT);
+	rfid_round_ctl(set[2], set[2], set[2]);
+	count = 0;
+	total = 0;
+	n = 0;
+	start = bench_ns();
+	last = start;
+
+	do {
+		t = bench_ns();
+		found = rfid_round(round, ROUND_TAGS);
+
+		for (i = 0; i < found; i++) {
+			total += round[i].count;
+
+			if (unique_add(unique, &count, round + i))
+				last = bench_ns();
+		}
+
+		if (n < ROUND_SIZE)
+			lat[n++] = bench_ns() - t;
+	} while ((bench_ns() - start) < duration * 1000000ULL);
+
+	t = bench_ns() - start;
+	qsort(lat, n, sizeof(uint64_t), cmp_u64);
+	report("inv_p50", set, percentile(lat, n, 50) / 1e6, "ms");
+	report("inv_max", set, percentile(lat, n, 100) / 1e6, "ms");
+	report("tags", set, total * 1e9 / t, "tags/s");
+	report("unique", set, count * 1e9 / t, "tags/s");
+
+	if (count)
+		report("unique_ms", set, (last - start) / 1e6, "ms");
+
+	rfid_shut();
+	return(TRUE);
+}
+
+int main(int argc, char **argv)
+{
+	char baud_def[] = "9600,115200";
+	char tags_def[] = "1,20,100";
+	char msec_def[] = "50,200";
+	uint32_t baud[LIST_SIZE], tags[LIST_SIZE], msec[LIST_SIZE];
+	uint32_t set[3], duration;
+	uint8_t nb, nn, nt, b, n, t, ok;
+	const char *emu;
+	uint64_t *lat;
+	uint16_t reads;
+	pid_t pid;
+	int opt;
+
+	emu = "build/m5e_emu";
+	nb = list_parse(baud_def, baud);
+	nn = list_parse(tags_def, tags);
+	nt = list_parse(msec_def, msec);
+	reads = 50;
+	duration = 2000;
+
+	while ((opt = getopt(argc, argv, "x:b:n:t:r:d:")) != -1) {
+		switch (opt) {
+		case 'x':
+			emu = optarg;
+			break;
+		case 'b':
+			nb = list_parse(optarg, baud);
+			break;
+		case 'n':
+			nn = list_parse(optarg, tags);
+			break;
+		case 't':
+			nt = list_parse(optarg, msec);
+			break;
+		case 'r':
+			reads = atoi(optarg);
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-x m5e_emu] [-b baud,..] "
+					"[-n tags,..] [-t msec,..] [-r reads] "
+					"[-d msec]\n", argv[0]);
+			return(EXIT_FAILURE);
+		}
+	}
+
+	if (reads > READ_SIZE)
+		reads = READ_SIZE;
+
+	snprintf(link_path, sizeof(link_path), "/tmp/bench_e2e.%d",
+			(int)getpid());
+	lat = malloc(sizeof(uint64_t) * (READ_SIZE > ROUND_SIZE ?
+				READ_SIZE : ROUND_SIZE));
+	ok = TRUE;
+
+	for (b = 0; b < nb; b++)
+		for (n = 0; n < nn; n++)
+			for (t = 0; t < nt; t++) {
+				set[0] = baud[b];
+				set[1] = tags[n];
+				set[2] = msec[t];
+				pid = emu_start(emu, set[0], set[1]);
+
+				if (pid < 0) {
+					fprintf(stderr, "%s: no pty\n", emu);
+					return(EXIT_FAILURE);
+				}
+
+				if (!run(set, reads, duration, lat))
+					ok = FALSE;
+
+				emu_stop(pid);
+			}
+
+	free(lat);
+	return(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
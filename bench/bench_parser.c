@@ -0,0 +1,131 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file bench_parser.c
+ * \brief frames/s of the reply parser.
+ *
+ * The stream of replies is fed to rx_byte() byte by byte.
+ *
+ * $ bench_parser [stream]
+ *
+ * The stream is a recorded file of replies, the raw bytes received
+ * from the reader. Without it a stream of replies of 0 - 250 data
+ * bytes is generated.
+ */
+
+#include "bench.h"
+#include <stdlib.h>
+#include "rfid_m5.h"
+#include "rfid_m5_private.h"
+
+#define STREAM_SIZE 1000000UL
+#define LOOPS 20
+
+/*! Generate a stream of valid replies. */
+static uint32_t generate(uint8_t *s, const uint32_t size)
+{
+	uint32_t n;
+	uint16_t crc;
+	uint8_t len, i;
+
+	n = 0;
+
+	while ((n + 262) < size) {
+		len = rand() % 251;
+		s[n++] = 0xff;
+		crc = 0xffff;
+		s[n] = len;
+		/* len, opcode, status and data */
+		s[n + 1] = 0x22;
+		s[n + 2] = 0;
+		s[n + 3] = 0;
+
+		for (i = 0; i < len; i++)
+			s[n + 4 + i] = rand();
+
+		for (i = 0; i < (len + 4); i++)
+			CRC_calcCrc8(&crc, s[n + i]);
+
+		n += len + 4;
+		s[n++] = (uint8_t)(crc >> 8);
+		s[n++] = (uint8_t)(crc & 0xff);
+	}
+
+	return(n);
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *stream;
+	uint32_t size, i, j, frames, bad;
+	uint64_t t;
+	FILE *f;
+
+	stream = malloc(STREAM_SIZE);
+
+	if (argc > 1) {
+		f = fopen(argv[1], "rb");
+
+		if (!f) {
+			perror(argv[1]);
+			return(EXIT_FAILURE);
+		}
+
+		size = fread(stream, 1, STREAM_SIZE, f);
+		fclose(f);
+	} else {
+		size = generate(stream, STREAM_SIZE);
+	}
+
+	rfid = malloc(sizeof(struct rfid_t));
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+	frames = 0;
+	bad = 0;
+	t = bench_ns();
+
+	for (j = 0; j < LOOPS; j++) {
+		rx_reset();
+
+		for (i = 0; i < size; i++)
+			if (rx_byte(stream[i])) {
+				if (rfid->error != RX_END)
+					bad++;
+				else
+					frames++;
+
+				/* wait for the next SOH */
+				rx_reset();
+			}
+	}
+
+	t = bench_ns() - t;
+	bench_report("parser", (double)frames * 1e9 / t, "frames/s");
+	bench_report("parser_bytes", (double)size * LOOPS * 1e9 / t, "bytes/s");
+	bench_report("parser_bad", (double)bad / LOOPS, "frames");
+	free(rfid->data);
+	free(rfid);
+	free(stream);
+
+	/* the generated replies are all valid */
+	if (bad && (argc < 2)) {
+		fprintf(stderr, "parser rejected %u valid frames\n", bad);
+		return(EXIT_FAILURE);
+	}
+
+	return(EXIT_SUCCESS);
+}
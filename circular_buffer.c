@@ -20,12 +20,39 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "circular_buffer.h"
+#include "trace.h"
+
+#ifdef CBUF_STATS
+#include "hal.h"
+
+#ifndef HAL_POSIX
+#include <util/atomic.h>
+#endif
+#endif
+
+#ifdef CBUF_STATS
+/*! The buffer is no longer full, count the time spent full.
+ */
+static void stats_unlock(struct cbuffer_t *cbuffer)
+{
+	if (cbuffer->overflow)
+		cbuffer->stats.full_ms += hal_millis() -
+		    cbuffer->stats.full_since;
+}
+#endif
 
 /*! Clear the buffer.
+ *
+ * \note the statistics are kept.
  */
 void cbuffer_clear(struct cbuffer_t *cbuffer)
 {
+#ifdef CBUF_STATS
+	stats_unlock(cbuffer);
+#endif
+
 	cbuffer->idx = 0;
 	cbuffer->start = 0;
 	cbuffer->len = 0;
@@ -44,6 +71,11 @@ struct cbuffer_t *cbuffer_init(void)
 	cbuffer = malloc(sizeof(struct cbuffer_t));
 	cbuffer->size = CBUF_SIZE;
 	cbuffer->buffer = malloc(CBUF_SIZE);
+	cbuffer->overflow = FALSE;
+
+#ifdef CBUF_STATS
+	memset(&cbuffer->stats, 0, sizeof(struct cbuffer_stats_t));
+#endif
 
 	if (cbuffer->buffer)
 		cbuffer->TOP = CBUF_SIZE - 1;
@@ -85,6 +117,11 @@ uint8_t bcpy(struct cbuffer_t *cbuffer,
 		cbuffer->start++;
 
 	cbuffer->len--;
+
+#ifdef CBUF_STATS
+	cbuffer->stats.popped++;
+#endif
+
 	return (j);
 }
 
@@ -118,6 +155,9 @@ uint8_t cbuffer_pop(struct cbuffer_t * cbuffer, uint8_t * data,
 			j = bcpy(cbuffer, data, size, j);
 
 		/* unlock the buffer */
+#ifdef CBUF_STATS
+		stats_unlock(cbuffer);
+#endif
 		cbuffer->overflow = FALSE;
 	}
 
@@ -189,6 +229,9 @@ uint8_t cbuffer_popm(struct cbuffer_t *cbuffer,
 		}
 
 		/* unlock the buffer */
+#ifdef CBUF_STATS
+		stats_unlock(cbuffer);
+#endif
 		cbuffer->overflow = FALSE;
 	}
 
@@ -205,8 +248,16 @@ uint8_t cbuffer_push(struct cbuffer_t * cbuffer, char rxc)
 	 * do nothing.
 	 */
 	if (cbuffer->overflow) {
+		TRACE(TRACE_CBUF_OVR);
+
+#ifdef CBUF_STATS
+		cbuffer->stats.dropped++;
+#endif
+
 		return (FALSE);
 	} else {
+		TRACE(TRACE_CBUF_PUSH);
+
 		/* catch overflow */
 		if (cbuffer->start) {
 			/* idx next to start? */
@@ -226,6 +277,64 @@ uint8_t cbuffer_push(struct cbuffer_t * cbuffer, char rxc)
 			cbuffer->idx++;
 
 		cbuffer->len++;
+
+#ifdef CBUF_STATS
+		cbuffer->stats.pushed++;
+
+		if (cbuffer->len > cbuffer->stats.peak)
+			cbuffer->stats.peak = cbuffer->len;
+
+		if (cbuffer->overflow) {
+			cbuffer->stats.overflows++;
+			cbuffer->stats.full_since = hal_millis();
+		}
+#endif
+
 		return (TRUE);
 	}
 }
+
+#ifdef CBUF_STATS
+/*! Copy and clear the statistics, see cbuffer_stats().
+ */
+static void stats_get(struct cbuffer_t *cbuffer,
+		      struct cbuffer_stats_t *stats, const uint8_t clear)
+{
+	*stats = cbuffer->stats;
+	stats->len = cbuffer->len;
+
+	if (cbuffer->overflow)
+		stats->full_ms += hal_millis() - stats->full_since;
+
+	if (clear) {
+		memset(&cbuffer->stats, 0, sizeof(struct cbuffer_stats_t));
+		cbuffer->stats.peak = cbuffer->len;
+
+		if (cbuffer->overflow)
+			cbuffer->stats.full_since = hal_millis();
+	}
+}
+
+/*! Get the traffic statistics of the buffer.
+ *
+ * Size the buffer on the peak, overflows and dropped bytes mean the
+ * consumer does not keep up with the producer, e.g. the ISR.
+ *
+ * \param cbuffer the circular buffer.
+ * \param stats where to copy them, the full_ms include the current
+ * full period if any.
+ * \param clear restart the counters, the peak from the current len.
+ */
+void cbuffer_stats(struct cbuffer_t *cbuffer,
+		   struct cbuffer_stats_t *stats, const uint8_t clear)
+{
+#ifdef HAL_POSIX
+	stats_get(cbuffer, stats, clear);
+#else
+	/* the ISR pushes */
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		stats_get(cbuffer, stats, clear);
+	}
+#endif
+}
+#endif
@@ -47,11 +47,37 @@
  * -D CBUF_OVR_CHAR='X'
  */
 
+/*! Optional, traffic statistics of every buffer.
+ *
+ * -D CBUF_STATS
+ *
+ * \see cbuffer_stats()
+ */
+
 #ifndef TRUE
 #define TRUE 1
 #define FALSE 0
 #endif
 
+#ifdef CBUF_STATS
+struct cbuffer_stats_t {
+	/* bytes pushed and popped */
+	uint32_t pushed;
+	uint32_t popped;
+	/* bytes in the buffer and the max ever */
+	uint8_t len;
+	uint8_t peak;
+	/* times the buffer got full */
+	uint16_t overflows;
+	/* bytes lost because the buffer was full */
+	uint16_t dropped;
+	/* msec spent full */
+	uint32_t full_ms;
+	/* hal_millis() when it got full */
+	uint32_t full_since;
+};
+#endif
+
 struct cbuffer_t {
 	uint8_t *buffer;
 	uint8_t idx;
@@ -85,6 +111,10 @@ struct cbuffer_t {
 
 		uint8_t flags;
 	};
+
+#ifdef CBUF_STATS
+	struct cbuffer_stats_t stats;
+#endif
 };
 
 void cbuffer_clear(struct cbuffer_t *cbuffer);
@@ -96,4 +126,9 @@ uint8_t cbuffer_popm(struct cbuffer_t *cbuffer, uint8_t * data,
 		     const uint8_t size, const uint8_t eom);
 uint8_t cbuffer_push(struct cbuffer_t *cbuffer, char rxc);
 
+#ifdef CBUF_STATS
+void cbuffer_stats(struct cbuffer_t *cbuffer,
+		   struct cbuffer_stats_t *stats, const uint8_t clear);
+#endif
+
 #endif
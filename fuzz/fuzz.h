@@ -0,0 +1,155 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file fuzz.h
+ * \brief Driver of the fuzz targets.
+ *
+ * Every target defines LLVMFuzzerTestOneInput(), which aborts when
+ * the code under test and the reference disagree, and
+ * fuzz_generate() for its random inputs.
+ *
+ * Built with clang -fsanitize=fuzzer libFuzzer provides the main,
+ * with -D FUZZ_MAIN (AFL or any compiler) the main here:
+ *
+ * $ target			one input from stdin, AFL
+ * $ target file ..		every file is an input
+ * $ target -n count [-s seed]	random inputs of fuzz_generate()
+ * $ target -w dir [-n count]	write random inputs as a seed corpus
+ */
+
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*! Max input size */
+#define FUZZ_SIZE 4096
+
+/*! Abort on a difference, the fuzzer keeps the input. */
+#define FUZZ_CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} \
+} while (0)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/*! Fill buf with a random input.
+ *
+ * \return the size of the input.
+ */
+size_t fuzz_generate(uint8_t *buf, const size_t size);
+
+#ifdef FUZZ_MAIN
+/*! Run an input from a stream. */
+static void fuzz_stream(FILE *f, uint8_t *buf)
+{
+	size_t n;
+
+	n = fread(buf, 1, FUZZ_SIZE, f);
+	LLVMFuzzerTestOneInput(buf, n);
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t buf[FUZZ_SIZE];
+	const char *dir;
+	char path[256];
+	uint32_t count, i;
+	size_t n;
+	FILE *f;
+	int opt;
+
+	count = 0;
+	dir = NULL;
+
+	while ((opt = getopt(argc, argv, "n:s:w:")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			srand(atoi(optarg));
+			break;
+		case 'w':
+			dir = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n count] [-s seed] "
+					"[-w dir] [file ..]\n", argv[0]);
+			return(EXIT_FAILURE);
+		}
+	}
+
+	if (dir) {
+		if (!count)
+			count = 32;
+
+		for (i = 0; i < count; i++) {
+			snprintf(path, sizeof(path), "%s/seed%03u", dir, i);
+			f = fopen(path, "wb");
+
+			if (!f) {
+				perror(path);
+				return(EXIT_FAILURE);
+			}
+
+			n = fuzz_generate(buf, FUZZ_SIZE);
+			fwrite(buf, 1, n, f);
+			fclose(f);
+		}
+
+		return(EXIT_SUCCESS);
+	}
+
+	for (i = 0; i < count; i++) {
+		n = fuzz_generate(buf, FUZZ_SIZE);
+		LLVMFuzzerTestOneInput(buf, n);
+	}
+
+	if (count)
+		printf("%s %u inputs ok\n", argv[0], count);
+
+	if (count || (optind < argc)) {
+		for (; optind < argc; optind++) {
+			f = fopen(argv[optind], "rb");
+
+			if (!f) {
+				perror(argv[optind]);
+				return(EXIT_FAILURE);
+			}
+
+			fuzz_stream(f, buf);
+			fclose(f);
+		}
+	} else {
+		fuzz_stream(stdin, buf);
+	}
+
+	return(EXIT_SUCCESS);
+}
+#endif /* FUZZ_MAIN */
+
+#endif
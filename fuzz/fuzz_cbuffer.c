@@ -0,0 +1,192 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file fuzz_cbuffer.c
+ * \brief The ring buffer against a reference FIFO.
+ *
+ * The input is a program of operations on a cbuffer_t:
+ *
+ * [0] [count] [bytes]	push count bytes
+ * [1] [size]		cbuffer_pop() of size bytes
+ * [2] [size] [eom]	cbuffer_popm() of size bytes up to eom
+ * [3]			cbuffer_clear()
+ *
+ * The opcode is the low 2 bits of the byte. The reference is a
+ * plain FIFO of CBUF_SIZE bytes: a push to a full buffer is dropped,
+ * a pop takes up to size bytes, a popm takes the bytes up to the
+ * eom included and copies up to size of them.
+ * A pop of 0 bytes is not a valid call and it is not generated.
+ */
+
+#include "fuzz.h"
+#include "circular_buffer.h"
+
+/*! Reference FIFO */
+struct fifo {
+	uint8_t buf[CBUF_SIZE];
+	uint16_t start;
+	uint16_t len;
+};
+
+static uint8_t fifo_get(struct fifo *f)
+{
+	uint8_t c;
+
+	c = f->buf[f->start];
+	f->start = (f->start + 1) % CBUF_SIZE;
+	f->len--;
+	return(c);
+}
+
+static uint8_t fifo_push(struct fifo *f, const uint8_t c)
+{
+	if (f->len == CBUF_SIZE)
+		return(FALSE);
+
+	f->buf[(f->start + f->len) % CBUF_SIZE] = c;
+	f->len++;
+	return(TRUE);
+}
+
+static uint8_t fifo_pop(struct fifo *f, uint8_t *data, const uint8_t size)
+{
+	uint8_t j;
+
+	for (j = 0; f->len && (j < size); j++)
+		data[j] = fifo_get(f);
+
+	return(j);
+}
+
+static uint8_t fifo_popm(struct fifo *f, uint8_t *data, const uint8_t size,
+		const uint8_t eom)
+{
+	uint8_t j, c;
+
+	j = 0;
+
+	while (f->len) {
+		c = fifo_get(f);
+
+		if (j < size)
+			data[j++] = c;
+
+		if (c == eom)
+			break;
+	}
+
+	return(j);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	uint8_t out[256], ref[256], n, m, count, eom;
+	struct cbuffer_t *cb;
+	struct fifo f;
+	size_t i;
+
+	cb = cbuffer_init();
+	memset(&f, 0, sizeof(f));
+	i = 0;
+
+	while (i < size) {
+		switch (data[i++] & 0x03) {
+		case 0:
+			count = (i < size) ? data[i++] : 0;
+
+			for (; count && (i < size); count--, i++)
+				FUZZ_CHECK(cbuffer_push(cb, data[i]) ==
+						fifo_push(&f, data[i]));
+
+			break;
+		case 1:
+			count = (i < size) ? data[i++] : 1;
+
+			if (!count)
+				count = 1;
+
+			n = cbuffer_pop(cb, out, count);
+			m = fifo_pop(&f, ref, count);
+			FUZZ_CHECK(n == m);
+			FUZZ_CHECK(!memcmp(out, ref, n));
+			break;
+		case 2:
+			count = (i < size) ? data[i++] : 1;
+			eom = (i < size) ? data[i++] : 0;
+
+			if (!count)
+				count = 1;
+
+			n = cbuffer_popm(cb, out, count, eom);
+			m = fifo_popm(&f, ref, count, eom);
+			FUZZ_CHECK(n == m);
+			FUZZ_CHECK(!memcmp(out, ref, n));
+			break;
+		default:
+			cbuffer_clear(cb);
+			f.start = 0;
+			f.len = 0;
+		}
+
+		FUZZ_CHECK(cb->len == f.len);
+		FUZZ_CHECK(cb->overflow == (f.len == CBUF_SIZE));
+	}
+
+	cbuffer_shut(cb);
+	return(0);
+}
+
+/*! Random programs, the bytes pushed are few values to hit the eom. */
+size_t fuzz_generate(uint8_t *buf, const size_t size)
+{
+	size_t n, i, len;
+	uint8_t op, count;
+
+	len = rand() % size;
+	n = 0;
+
+	while ((n + 3) <= len) {
+		op = rand() % 4;
+
+		/* few clear */
+		if ((op == 3) && (rand() % 4))
+			op = 0;
+
+		buf[n++] = op;
+
+		switch (op) {
+		case 0:
+			count = rand();
+			buf[n++] = count;
+
+			for (i = 0; (i < count) && (n < len); i++)
+				buf[n++] = rand() % 8;
+
+			break;
+		case 1:
+			buf[n++] = rand();
+			break;
+		case 2:
+			buf[n++] = rand();
+			buf[n++] = rand() % 8;
+			break;
+		}
+	}
+
+	return(n);
+}
@@ -0,0 +1,169 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file fuzz_parser.c
+ * \brief The reply parser against a reference decoder.
+ *
+ * The input is a stream of bytes from the reader, it is fed to
+ * rx_byte() one byte at a time as rfid_cmd_poll() does, restarting
+ * from the SOH after every frame. The reference decodes the whole
+ * stream at once, with the CRC of the M5_CRC_STEP() macro, and
+ * every frame must match: opcode, status, data and CRC result.
+ */
+
+#include "fuzz.h"
+#include "rfid_m5.h"
+#include "rfid_m5_private.h"
+
+/*! A frame, the data point to the input */
+struct frame {
+	uint8_t len;
+	uint8_t opcode;
+	uint16_t status;
+	const uint8_t *data;
+	uint8_t ok;
+};
+
+static uint16_t be16(const uint8_t *p)
+{
+	return(((uint16_t)p[0] << 8) | p[1]);
+}
+
+/*! Reference decoder of the next frame.
+ *
+ * > ff [len] [opcode] [status(2)] [data(len)] [crc(2)]
+ *
+ * Bytes before the SOH are skipped, a frame with a bad CRC is
+ * consumed whole, as the parser does.
+ *
+ * \return the bytes used, 0 no complete frame left.
+ */
+static size_t ref_decode(const uint8_t *p, const size_t size,
+		struct frame *f)
+{
+	uint16_t crc;
+	size_t i, n;
+
+	for (i = 0; (i < size) && (p[i] != 0xff); i++);
+
+	if ((i + 5) >= size)
+		return(0);
+
+	f->len = p[i + 1];
+	n = f->len + 7;
+
+	if ((i + n) > size)
+		return(0);
+
+	f->opcode = p[i + 2];
+	f->status = be16(p + i + 3);
+	f->data = p + i + 5;
+	crc = 0xffff;
+
+	for (n = 1; n < (f->len + 5U); n++)
+		crc = M5_CRC_STEP(crc, p[i + n]);
+
+	f->ok = (crc == be16(p + i + f->len + 5));
+	return(i + f->len + 7);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static uint8_t buf[RFID_BUFFER_SIZE];
+	static struct rfid_t r;
+	const uint8_t *p, *q, *end;
+	struct frame f;
+	size_t n;
+
+	rfid = &r;
+	rfid->data = buf;
+	rx_reset();
+	end = data + size;
+	p = data;
+	n = ref_decode(p, size, &f);
+
+	for (q = p; q < end; q++) {
+		if (!rx_byte(*q))
+			continue;
+
+		/* the parser ends a frame where the reference does */
+		FUZZ_CHECK(n && (q == (p + n - 1)));
+		FUZZ_CHECK(rfid->len == f.len);
+		FUZZ_CHECK(rfid->opcode == f.opcode);
+		FUZZ_CHECK(rfid->status == f.status);
+		FUZZ_CHECK(!memcmp(rfid->data, f.data, f.len));
+		FUZZ_CHECK((rfid->error == RX_END) == f.ok);
+
+		rx_reset();
+		p = q + 1;
+		n = ref_decode(p, end - p, &f);
+	}
+
+	/* no frame left behind */
+	FUZZ_CHECK(!n);
+	return(0);
+}
+
+/*! Valid frames, with some noise and corruption. */
+size_t fuzz_generate(uint8_t *buf, const size_t size)
+{
+	uint16_t crc;
+	size_t n, i;
+	uint8_t len;
+
+	n = 0;
+
+	while ((n + 262) < size) {
+		/* noise between the frames */
+		if (!(rand() % 8))
+			buf[n++] = rand();
+
+		len = (rand() % 4) ? rand() % 32 : rand();
+		buf[n] = 0xff;
+		buf[n + 1] = len;
+		buf[n + 2] = rand();
+		buf[n + 3] = (rand() % 4) ? 0 : rand();
+		buf[n + 4] = (rand() % 4) ? 0 : rand();
+
+		for (i = 0; i < len; i++)
+			buf[n + 5 + i] = rand();
+
+		crc = 0xffff;
+
+		for (i = 1; i < (len + 5U); i++)
+			crc = M5_CRC_STEP(crc, buf[n + i]);
+
+		buf[n + len + 5] = (uint8_t)(crc >> 8);
+		buf[n + len + 6] = (uint8_t)(crc & 0xff);
+
+		/* a corrupted byte */
+		if (!(rand() % 8))
+			buf[n + 1 + rand() % (len + 6)] ^= 1 << (rand() % 8);
+
+		n += len + 7;
+
+		if (!(rand() % 16))
+			break;
+	}
+
+	/* a truncated frame at the end */
+	if (n && !(rand() % 4))
+		n -= rand() % 8;
+
+	return(n);
+}
@@ -0,0 +1,75 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file hal.h
+ * \brief Hardware abstraction, timer and flash access.
+ *
+ * The serial port is the usart.h interface, implemented by
+ * usart.c on the AVR and usart_posix.c on a host.
+ *
+ * backend:
+ *  AVR, the default, hal_avr.c usart.c
+ *  Linux or any POSIX host, hal_posix.c usart_posix.c
+ * -D HAL_POSIX
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+#ifdef HAL_POSIX
+
+#include <string.h>
+
+/*! Constant data are plain data on a host */
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define memcpy_P memcpy
+
+/*! The EEPROM is RAM on a host, it is lost on exit */
+#define EEMEM
+#define eeprom_read_block(dst, src, n) memcpy((dst), (src), (n))
+#define eeprom_update_block(src, dst, n) memcpy((dst), (src), (n))
+#define eeprom_update_word(p, v) (*(p) = (v))
+
+#else
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+
+/*! Timer0 ticks every msec, see hal_init().
+ *
+ * On by default, the command timeouts need a running clock.
+ * -D HAL_NO_TIMER0 leaves the timer0 free, then only the time
+ * spent in hal_delay_ms() is counted.
+ */
+#if !defined(HAL_TIMER0) && !defined(HAL_NO_TIMER0)
+#define HAL_TIMER0
+#endif
+
+#endif /* HAL_POSIX */
+
+void hal_init(void);
+void hal_delay_ms(const uint16_t ms);
+uint32_t hal_millis(void);
+uint32_t hal_micros(void);
+uint16_t hal_ticks(void);
+
+#endif
@@ -0,0 +1,124 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+#include "hal.h"
+
+/*! msec since hal_init(), or counted by hal_delay_ms() */
+static volatile uint32_t millis;
+
+#ifdef HAL_TIMER0
+/*! Timer0 compare match, every msec. */
+ISR(TIMER0_COMPA_vect)
+{
+	millis++;
+}
+#endif
+
+/*! Start the msec clock.
+ *
+ * With HAL_TIMER0 the timer0 runs in CTC mode at 1KHz
+ * (F_CPU / 64 / 1000 rounded), with HAL_NO_TIMER0 only the time
+ * spent in hal_delay_ms() is counted.
+ */
+void hal_init(void)
+{
+	millis = 0;
+
+#ifdef HAL_TIMER0
+	TCCR0A = _BV(WGM01);
+	OCR0A = (uint8_t)((F_CPU / 64UL + 500UL) / 1000UL - 1);
+	TIMSK0 = _BV(OCIE0A);
+	TCCR0B = _BV(CS01) | _BV(CS00);
+#endif
+}
+
+/*! Wait ms msec. */
+void hal_delay_ms(const uint16_t ms)
+{
+	uint16_t i;
+
+	for (i = 0; i < ms; i++)
+		_delay_ms(1);
+
+#ifndef HAL_TIMER0
+	millis += ms;
+#endif
+}
+
+/*! msec from hal_init(). */
+uint32_t hal_millis(void)
+{
+	uint32_t ms;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ms = millis;
+	}
+
+	return(ms);
+}
+
+/*! usec from hal_init(), it wraps in 71 minutes.
+ *
+ * With HAL_TIMER0 the resolution is 64 cpu cycles, otherwise only
+ * the msec of hal_delay_ms() are counted.
+ */
+uint32_t hal_micros(void)
+{
+	uint32_t ms;
+	uint8_t t;
+
+	t = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ms = millis;
+
+#ifdef HAL_TIMER0
+		t = TCNT0;
+
+		/* compare match not yet served */
+		if ((TIFR0 & _BV(OCF0A)) && (t < OCR0A))
+			ms++;
+#endif
+	}
+
+	/* 64 cpu cycles every count, t * 64000 fits in 32 bits */
+	return(ms * 1000UL + (uint32_t)t * 64000UL / (F_CPU / 1000UL));
+}
+
+/*! Free running 16 bits timestamp of trace.h.
+ *
+ * The msec in the high byte, with HAL_TIMER0 the timer0 count in
+ * the low one. No lock, it can be called from an ISR.
+ */
+uint16_t hal_ticks(void)
+{
+	uint16_t t;
+
+	t = (uint16_t)((uint8_t)millis) << 8;
+
+#ifdef HAL_TIMER0
+	t |= TCNT0;
+#endif
+
+	return(t);
+}
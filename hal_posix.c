@@ -0,0 +1,70 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <time.h>
+#include "hal.h"
+
+/*! The monotonic clock at hal_init() */
+static struct timespec start;
+
+/*! Start the msec clock. */
+void hal_init(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+/*! Wait ms msec. */
+void hal_delay_ms(const uint16_t ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+
+	while (nanosleep(&ts, &ts))
+		;
+}
+
+/*! msec from hal_init(). */
+uint32_t hal_millis(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint32_t)((now.tv_sec - start.tv_sec) * 1000 +
+				(now.tv_nsec - start.tv_nsec) / 1000000L));
+}
+
+/*! usec from hal_init(), it wraps in 71 minutes. */
+uint32_t hal_micros(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((uint32_t)((now.tv_sec - start.tv_sec) * 1000000UL +
+				(now.tv_nsec - start.tv_nsec) / 1000L));
+}
+
+/*! Free running 16 bits timestamp of trace.h, usec. */
+uint16_t hal_ticks(void)
+{
+	return((uint16_t)hal_micros());
+}
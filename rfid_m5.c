@@ -19,10 +19,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <avr/io.h>
-#include <avr/pgmspace.h>
-#include <util/delay.h>
+#include "hal.h"
 #include "rfid_m5.h"
+#include "rfid_m5_private.h"
+#include "trace.h"
+
+struct rfid_t *rfid;
 
 /** @fn void CRC_calcCrc8(u16 *crcReg, u16 poly, u16 u8Data)
  * @ Standard CRC calculation on an 8-bit piece of data. To make it
@@ -98,323 +100,3135 @@ uint16_t m5_crc(const uint8_t include_status)
 	return(crc16);
 }
 
-/*! TX the struct to m5
+/*! Constant frames of the resume sequence.
  *
- * The packet structure is:
- * Hdr(1) + datalen(1) + Cmd(1) + data(N) + CRC(Hi + Lo)
+ * \see rfid_resume()
+ */
+static const uint8_t PROGMEM m5_boot[] = { M5_FRAME_0(0x04) };
+static const uint8_t PROGMEM m5_region[] = { M5_FRAME_1(0x97, 0x02) };
+static const uint8_t PROGMEM m5_region_get[] = { M5_FRAME_0(0x67) };
+static const uint8_t PROGMEM m5_protocol[] = { M5_FRAME_2(0x93, 0x00, 0x05) };
+static const uint8_t PROGMEM m5_power[] = { M5_FRAME_1(0x98, 0x03) };
+#ifdef RFID_M5_LOWTXPWR
+static const uint8_t PROGMEM m5_txpwr[] = {
+	M5_FRAME_2(0x92, RFID_M5_TX_RDBM_H, RFID_M5_TX_RDBM_L) };
+#endif
+static const uint8_t PROGMEM m5_config[] = {
+	M5_FRAME_3(0x9a, 0x01, 0x02, 0x01) };
+
+/*! Clear Tag ID Buffer (2Ah) */
+static const uint8_t PROGMEM m5_tagbuf_clear[] = { M5_FRAME_0(0x2a) };
+
+#ifdef RFID_M5_CFG_EEPROM
+/*! Copy of rfid->cfg[] across resets */
+static uint16_t EEMEM ee_cfg[RFID_CFG_SIZE];
+#endif
+
+#ifdef RFID_M5_HIST
+/*! Time the start of the command phase n, see rfid_hist_dump() */
+#define HIST_STAMP(n) (rfid->stamp[n] = hal_micros())
+
+/*! Names of the phases in the dump */
+static const char *hist_phase[RFID_HIST_PHASES] = {
+	"tx", "think", "rx", "crc" };
+
+/*! The slot of the opcode, a free one is taken.
+ *
+ * \return the slot, NULL the table is full.
+ */
+static struct rfid_hist_t *hist_slot(const uint8_t opcode)
+{
+	struct rfid_hist_t *hist;
+
+	for (hist = rfid->hist; hist < (rfid->hist + RFID_HIST_SIZE); hist++)
+		if ((hist->opcode == opcode) || !hist->opcode) {
+			hist->opcode = opcode;
+			return(hist);
+		}
+
+	return(NULL);
+}
+
+/*! The bucket of a time in usec. */
+static uint8_t hist_bucket(uint32_t usec)
+{
+	uint8_t i;
+
+	usec >>= RFID_HIST_SHIFT;
+
+	for (i = 0; usec && (i < (RFID_HIST_BUCKETS - 1)); i++)
+		usec >>= 1;
+
+	return(i);
+}
+
+/*! Count the phases of the command ended.
  *
+ * \param ok the command result, the phases of a failed command are
+ * not counted.
  */
-void tx_pkt(void)
+static void hist_add(const uint8_t ok)
+{
+	struct rfid_hist_t *hist;
+	uint16_t *count;
+	uint8_t i;
+
+	hist = hist_slot(rfid->cmd);
+
+	if (!hist)
+		return;
+
+	if (!ok) {
+		if (hist->fail < 0xffff)
+			hist->fail++;
+
+		return;
+	}
+
+	for (i = 0; i < RFID_HIST_PHASES; i++) {
+		count = hist->count[i] +
+			hist_bucket(rfid->stamp[i + 1] - rfid->stamp[i]);
+
+		if (*count < 0xffff)
+			(*count)++;
+	}
+}
+
+/*! Clear the histograms. */
+void rfid_hist_clear(void)
+{
+	memset(rfid->stamp, 0, sizeof(rfid->stamp));
+	memset(rfid->hist, 0, sizeof(rfid->hist));
+}
+
+/*! Print a number in decimal, a space before. */
+static void hist_print(const uint8_t port, uint16_t n)
 {
+	char s[7];
 	uint8_t i;
 
-	usart_putchar(RFID_USART, rfid->soh);
-	usart_putchar(RFID_USART, rfid->len);
-	usart_putchar(RFID_USART, rfid->opcode);
+	i = sizeof(s) - 1;
+	s[i] = 0;
 
-	for (i=0; i<(rfid->len); i++)
-		usart_putchar(RFID_USART, *(rfid->data + i));
+	do {
+		s[--i] = '0' + (n % 10);
+		n /= 10;
+	} while (n);
 
-	/* Send CRC Hi */
-	usart_putchar(RFID_USART, (uint8_t)(rfid->crc >> 8));
-	/* Send CRC Lo */
-	usart_putchar(RFID_USART, (uint8_t)(rfid->crc & 0xff));
+	s[--i] = ' ';
+	usart_printstr(port, s + i);
 }
 
-/*! RX from m5
+/*! Dump the histograms on a serial port, usually the debug one.
+ *
+ * A block every opcode sent:
+ *
+ * op 22 fail 0
+ * tx [bucket 0] .. [bucket 15]
+ * think ..
+ * rx ..
+ * crc ..
  *
- * Extract one single byte at a time from the buffer and store
- * it in the rfid structure. Every step is recorded in the rfid->error,
- * in case of failure it is possible to know at which step the problem occured.
+ * The opcode is in hex, the counts in decimal.
  *
- * The rfid reply should be in 650msec max.
+ * \param port the serial port, not the reader's one.
+ */
+void rfid_hist_dump(const uint8_t port)
+{
+	struct rfid_hist_t *hist;
+	uint8_t i, j;
+
+	for (hist = rfid->hist; hist < (rfid->hist + RFID_HIST_SIZE); hist++) {
+		if (!hist->opcode)
+			break;
+
+		usart_printstr(port, "op ");
+		usart_putchar(port, "0123456789abcdef"[hist->opcode >> 4]);
+		usart_putchar(port, "0123456789abcdef"[hist->opcode & 0x0f]);
+		usart_printstr(port, " fail");
+		hist_print(port, hist->fail);
+		usart_printstr(port, "\r\n");
+
+		for (i = 0; i < RFID_HIST_PHASES; i++) {
+			usart_printstr(port, hist_phase[i]);
+
+			for (j = 0; j < RFID_HIST_BUCKETS; j++)
+				hist_print(port, hist->count[i][j]);
+
+			usart_printstr(port, "\r\n");
+		}
+	}
+}
+#else
+#define HIST_STAMP(n)
+#endif
+
+/*! Get a byte of the frame to TX.
  *
  * The packet structure is:
- * Hdr(1) + datalen(1) + Cmd(1) + Status(2) + data(N) + CRC(Hi + Lo)
+ * Hdr(1) + datalen(1) + Cmd(1) + data(N) + CRC(Hi + Lo)
  *
- * \param timeout express in 100*msec
- * \return TRUE in case of a correct packet received.
- * \warning rfid.data must be already malloc-ed
+ * \param idx the position of the byte in the frame.
  */
-uint8_t rx_pkt(uint16_t timeout)
+uint8_t tx_byte(const uint16_t idx)
 {
-	uint8_t i;
+	if (rfid->frame)
+		return(pgm_read_byte(rfid->frame + idx));
 
-#define END 0
-#define SOH 1
-#define LEN 2
-#define CMD 3
-#define STATUS 4
-#define DATA 5
-#define CRC 6
+	if (!idx)
+		return(rfid->soh);
 
-	i = 0;
-	rfid->error = SOH;
+	if (idx == 1)
+		return(rfid->len);
 
-	while (timeout) {
-		_delay_ms(10);
+	if (idx == 2)
+		return(rfid->opcode);
 
-		switch (rfid->error) {
-			case SOH:
-				if (usart_get(RFID_USART_PORT, &rfid->soh, 1)
-						&& (rfid->soh == 0xff))
-					rfid->error = LEN;
-				break;
-			case LEN:
-				if (usart_get(RFID_USART_PORT, &rfid->len, 1))
-					rfid->error = CMD;
-				break;
-			case CMD:
-				if (usart_get(RFID_USART_PORT, &rfid->opcode, 1)) {
-					/* next step requires 2 read-cycle */
-					i = 0;
-					rfid->error = STATUS;
-				}
-
-			case STATUS:
-				if (i < 2) {
-					if (usart_get(RFID_USART_PORT, (uint8_t *)&rfid->status + 1 - i, 1))
-						i++;
-				} else {
-					/* next step requires many read-cycle */
-					i = 0;
-					rfid->error = DATA;
-				}
+	if (idx < (rfid->len + 3))
+		return(*(rfid->data + idx - 3));
 
-				break;
-			case DATA:
-				if (i < rfid->len) {
-					if (usart_get(RFID_USART_PORT, rfid->data + i, 1))
-						i++;
-				} else {
-					/* next step requires 2 read-cycle */
-					i = 0;
-					rfid->error = CRC;
-				}
+	/* CRC Hi */
+	if (idx == (rfid->len + 3))
+		return((uint8_t)(rfid->crc >> 8));
 
-				break;
-			case CRC:
-				if (i < 2) {
-					/* Little Endian, MSB come first */
-					if (usart_get(RFID_USART_PORT, (uint8_t *)&rfid->crc + 1 - i, 1))
-						i++;
-				} else {
-					if (m5_crc(TRUE) == rfid->crc)
-						rfid->error = END;
-
-					timeout = 1;
-				}
+	/* CRC Lo */
+	return((uint8_t)(rfid->crc & 0xff));
+}
 
-				break;
-			case END:
-			default:
-				timeout = 1;
-				break;
-		}
+#ifdef RFID_M5_LOG
+/*! Record the frame, see log_frame() */
+#define LOG_FRAME(flags) log_frame(flags)
 
-		timeout--;
-	}
+/*! Append a byte to the log. */
+static void log_put(const uint8_t c)
+{
+	rfid->log.buf[rfid->log.head] = c;
+	rfid->log.head = (rfid->log.head + 1) % RFID_LOG_SIZE;
+	rfid->log.used++;
+}
 
-	return(rfid->error);
+/*! Byte i of the log from the oldest record. */
+static uint8_t log_peek(const uint16_t i)
+{
+	return(rfid->log.buf[(rfid->log.tail + i) % RFID_LOG_SIZE]);
 }
 
-/*! Send a command to the device and get the ACK/ANSWER
+/*! Size of a record.
  *
- * Prepare the correct rfid field (SOH and CRC) the send it to
- * the device, wait for the answer/ack and checkit.
+ * \param flags RFID_LOG_*.
+ * \param len the frame data length.
+ */
+static uint16_t log_size(const uint8_t flags, const uint8_t len)
+{
+	if (flags & RFID_LOG_TIMEOUT)
+		return(3);
+
+	return(len + ((flags & RFID_LOG_RX) ? 9 : 7));
+}
+
+/*! Record the frame just sent or received.
  *
- * \return TRUE command send and ack properly received.
+ * The frame is the one in the rfid struct, for the TX the one
+ * tx_byte() sends.
+ *
+ * \param flags RFID_LOG_*.
  */
-uint8_t send_cmd(void)
+static void log_frame(const uint8_t flags)
 {
-	uint8_t cmd;
+	uint16_t size, i, ms;
 
-	cmd = rfid->opcode;
-	rfid->soh = 0xff;
-	rfid->crc = m5_crc(FALSE);
-	tx_pkt();
-	/* reply in 650msec max */
-	rx_pkt(500);
+	size = log_size(flags, rfid->len);
 
-	if ((!rfid->error) && (rfid->opcode == cmd) && (!rfid->status))
-		return(TRUE);
-	else
-		return(FALSE);
+	if (size > RFID_LOG_SIZE)
+		return;
+
+	/* drop the oldest records */
+	while ((RFID_LOG_SIZE - rfid->log.used) < size) {
+		i = log_size(log_peek(0), log_peek(3));
+		rfid->log.tail = (rfid->log.tail + i) % RFID_LOG_SIZE;
+		rfid->log.used -= i;
+		rfid->log.lost++;
+	}
+
+	ms = (uint16_t)hal_millis();
+	log_put(flags);
+	log_put((uint8_t)(ms >> 8));
+	log_put((uint8_t)(ms & 0xff));
+
+	if (flags & RFID_LOG_TIMEOUT)
+		return;
+
+	if (!(flags & RFID_LOG_RX)) {
+		/* from the len to the CRC */
+		for (i = 1; i < (rfid->len + 5); i++)
+			log_put(tx_byte(i));
+
+		return;
+	}
+
+	log_put(rfid->len);
+	log_put(rfid->opcode);
+	log_put((uint8_t)(rfid->status >> 8));
+	log_put((uint8_t)(rfid->status & 0xff));
+
+	for (i = 0; i < rfid->len; i++)
+		log_put(rfid->data[i]);
+
+	log_put((uint8_t)(rfid->crc >> 8));
+	log_put((uint8_t)(rfid->crc & 0xff));
 }
 
-/*! Get the RFID code.
+/*! Clear the frame log. */
+void rfid_log_clear(void)
+{
+	rfid->log.head = 0;
+	rfid->log.tail = 0;
+	rfid->log.used = 0;
+	rfid->log.lost = 0;
+}
+
+/*! Dump the frame log on a serial port, then clear it.
  *
- * String size of the code is RFID size * 2 plus the CRC plus \0.
+ * The dump is binary:
  *
- * \param data pre-allocated byte space.
- * \return TRUE rfid code is present, FALSE no valid code.
+ * "M5L" [version] [bytes(2)] [records lost(2)] [records]
+ *
+ * decode it with tools/m5e_log.c.
+ *
+ * \param port the serial port, not the reader's one.
  */
-uint8_t rfid_read(uint8_t* data)
+void rfid_log_dump(const uint8_t port)
 {
-	uint8_t ok;
+	uint16_t i;
 
-#ifdef RFID_M5_PASSWORD
-	static const uint8_t PROGMEM cmd_read[] = {
-		0x03, 0xe8,
-		0x02, 0x01, 0x00, 0x00,0x00,0x02,
-		0x08,
-		RFID_M5_PASSWORD,
-		0x00, 0x00, 0x00, 0x00,
-		RFID_M5_SINGULATION};
+	usart_printstr(port, "M5L");
+	usart_putchar(port, RFID_LOG_VERSION);
+	usart_putchar(port, (uint8_t)(rfid->log.used >> 8));
+	usart_putchar(port, (uint8_t)(rfid->log.used & 0xff));
+	usart_putchar(port, (uint8_t)(rfid->log.lost >> 8));
+	usart_putchar(port, (uint8_t)(rfid->log.lost & 0xff));
+
+	for (i = 0; i < rfid->log.used; i++)
+		usart_putchar(port, log_peek(i));
+
+	usart_flush(port);
+	rfid_log_clear();
+}
+#else
+#define LOG_FRAME(flags)
 #endif
 
-	rfid->data = malloc(0xff);
-	usart_clear_rx_buffer(RFID_USART);
+/*! Restart the rx parser, it waits for the SOH of a frame.
+ */
+void rx_reset(void)
+{
+	rfid->error = RX_SOH;
+}
 
-#ifdef RFID_M5_PASSWORD
-	/* # Read the EPC of a locked TAG
-	 * cmd:                28 (read memory)
-	 * Time out:           03e8
-	 * Singulation Option: 02 (select singulation on TID)
-	 * Read Membank:       01 (EPC)
-	 * Read Address:       00000002 (starting from 2 word inside the EPC memory)
-	 * Word count:         08 (16 Byte EPC lenght)
-	 * Access code:        xxxxxxxx (to be changed!)
-	 * Singulation addr:   00000000 (TID starting address)
-	 * Signulation lenght: 08 bit (1 byte to match to select the tag)
-	 * Singulation data:   e2 (select the tag with TID starting with e2)
-	 *
-	 * > 28 03e8 02 01 00000002 08 xxxxxxxx 00000000 01 e2
-	 */
-	rfid->len = 0x1e;
-	rfid->opcode = 0x28;
-	memcpy_P(rfid->data, cmd_read, rfid->len);
-	ok = send_cmd();
+/*! RX a byte from m5
+ *
+ * Store the byte in the rfid structure, the current step is
+ * recorded in the rfid->error.
+ *
+ * The packet structure is:
+ * Hdr(1) + datalen(1) + Cmd(1) + Status(2) + data(N) + CRC(Hi + Lo)
+ *
+ * Status and CRC are sent MSB first.
+ *
+ * \param c the byte received.
+ * \return TRUE the packet is complete, check rfid->error for
+ * the result.
+ * \warning rfid.data must be already malloc-ed
+ */
+uint8_t rx_byte(const uint8_t c)
+{
+	switch (rfid->error) {
+		case RX_SOH:
+			if (c == 0xff) {
+				rfid->soh = c;
+				rfid->error = RX_LEN;
+				HIST_STAMP(RFID_HIST_RX);
+			}
 
-	/* \bug copy rfid->len or rfid->size ? FIXME */
-	if (ok)
-		memcpy(data, rfid->data + 1, rfid->size);
-#else
-	/* Read the EPC of the 1st tag available
-	 * ff022103e8d509
-	 * 0x03e8 1 sec. timeout
-	 * 0x2710 10 sec. timeout
-	 */
-	rfid->len = 0x02;
-	rfid->opcode = 0x21;
-	rfid->data[0] = 0x03;
-	rfid->data[1] = 0xe8;
-	ok = send_cmd();
+			break;
+		case RX_LEN:
+			rfid->len = c;
+			rfid->error = RX_CMD;
+			break;
+		case RX_CMD:
+			rfid->opcode = c;
+			/* next step requires 2 bytes */
+			rfid->idx = 0;
+			rfid->error = RX_STATUS;
+			break;
+		case RX_STATUS:
+			rfid->status = (rfid->status << 8) | c;
+			rfid->idx++;
+
+			if (rfid->idx == 2) {
+				/* next step requires many bytes */
+				rfid->idx = 0;
+
+				if (rfid->len)
+					rfid->error = RX_DATA;
+				else
+					rfid->error = RX_CRC;
+			}
+
+			break;
+		case RX_DATA:
+			*(rfid->data + rfid->idx) = c;
+			rfid->idx++;
+
+			if (rfid->idx == rfid->len) {
+				/* next step requires 2 bytes */
+				rfid->idx = 0;
+				rfid->error = RX_CRC;
+			}
+
+			break;
+		case RX_CRC:
+			rfid->crc = (rfid->crc << 8) | c;
+			rfid->idx++;
+
+			if (rfid->idx == 2) {
+				HIST_STAMP(RFID_HIST_CRC);
+
+				if (m5_crc(TRUE) == rfid->crc)
+					rfid->error = RX_END;
+
+				HIST_STAMP(RFID_HIST_PHASES);
+
+				return(TRUE);
+			}
+
+			break;
+		case RX_END:
+		default:
+			return(TRUE);
+	}
+
+	return(FALSE);
+}
 
-	/*! \bug copy rfid->len or rfid->size ? FIXME */
+/*! The reply received closes the command successfully.
+ *
+ * No Tags Found (0400h) of Read Tag Multiple (22h) is an empty
+ * round, not a failure, the count is 0.
+ *
+ * \return TRUE the reply is valid and its status is ok.
+ */
+static uint8_t reply_ok(void)
+{
+	if (rfid->error || (rfid->opcode != rfid->cmd))
+		return(FALSE);
+
+	return(!rfid->status ||
+			((rfid->cmd == 0x22) && (rfid->status == 0x0400)));
+}
+
+/*! Close the async command.
+ *
+ * \param ok the command result.
+ */
+void cmd_end(const uint8_t ok)
+{
 	if (ok)
-		memcpy(data, rfid->data, rfid->size);
+		rfid->state = RFID_CMD_DONE;
+	else
+		rfid->state = RFID_CMD_FAIL;
+
+#ifdef RFID_M5_HIST
+	hist_add(ok);
 #endif
 
-	free(rfid->data);
-	return(ok);
+	TRACE(ok ? TRACE_CMD_OK : TRACE_CMD_FAIL);
+
+	if (rfid->callback)
+		rfid->callback(ok);
 }
 
-/*! Suspend call.
+/*! Check if a command is in progress.
  *
- * \ingroup sleep_group
+ * \return TRUE the command is under tx or waiting for the reply.
  */
-void rfid_suspend(void)
+uint8_t rfid_cmd_busy(void)
 {
-	usart_suspend(RFID_USART_PORT);
+	return((rfid->state == RFID_CMD_TX) || (rfid->state == RFID_CMD_RX));
 }
 
-/*! Resume call.
+/*! Start the tx of the frame already prepared.
  *
- * \ingroup sleep_group
+ * \param timeout in msec from now.
  */
-uint8_t rfid_resume(void)
+void cmd_start(const uint32_t timeout, void (*callback)(const uint8_t ok))
 {
-	rfid->data = malloc(0xff);
-	usart_resume(RFID_USART_PORT);
-	_delay_ms(100);
+	rfid->cmd = rfid->opcode;
+	rfid->idx = 0;
+	rfid->deadline = hal_millis() + timeout;
+	rfid->callback = callback;
+	rx_reset();
+	rfid->state = RFID_CMD_TX;
+	HIST_STAMP(RFID_HIST_TX);
+	LOG_FRAME(0);
+}
 
-	/* Boot Firmware (04h):
-	 * ff00041d0b
-	 *
-	 * The maximum time required to boot the application firmware is 650ms.
-	 */
-	rfid->len = 0;
-	rfid->opcode = 0x04;
-	send_cmd();
-
-	/* The firmware may be already started */
-	if (rfid->error && (rfid->status == 0x0101))
-		rfid->error = FALSE;
-
-	if (!rfid->error) {
-		/* Set Current Region (97h)
-		 * EU: ff0197024bbf
-		 * EU3: ff0197084bb5
-		 */
-		rfid->len = 0x01;
-		rfid->opcode = 0x97;
-		rfid->data[0] = 0x02;
-		send_cmd();
+/*! Submit a command to the device without waiting.
+ *
+ * The rfid->opcode, rfid->len and rfid->data must be already set,
+ * SOH and CRC are calculated here. The command proceeds with
+ * rfid_cmd_poll(), on completion the rfid struct contains the reply.
+ *
+ * \param timeout in msec, the command fails if no reply is
+ * completed within, as hal_millis() counts it.
+ * \param callback called once when the command ends, can be NULL.
+ * \return TRUE the command has been accepted, FALSE another command
+ * is in progress.
+ * \warning rfid.data must be already malloc-ed and kept until the end
+ * of the command.
+ */
+uint8_t rfid_cmd_submit(const uint32_t timeout,
+		void (*callback)(const uint8_t ok))
+{
+	if (rfid_cmd_busy())
+		return(FALSE);
+
+	rfid->frame = NULL;
+	rfid->soh = 0xff;
+	rfid->crc = m5_crc(FALSE);
+	cmd_start(timeout, callback);
+	return(TRUE);
+}
+
+/*! Submit a constant frame without waiting.
+ *
+ * The frame is already encoded (SOH, len, opcode, data and CRC),
+ * usually with the M5_FRAME_n() macros, and it is sent as it is.
+ *
+ * \param frame the PROGMEM frame.
+ * \see rfid_cmd_submit()
+ * \warning rfid.data must be already malloc-ed for the reply.
+ */
+uint8_t rfid_cmd_submit_P(const uint8_t *frame, const uint32_t timeout,
+		void (*callback)(const uint8_t ok))
+{
+	if (rfid_cmd_busy())
+		return(FALSE);
+
+	rfid->frame = frame;
+	rfid->soh = 0xff;
+	rfid->len = pgm_read_byte(frame + 1);
+	rfid->opcode = pgm_read_byte(frame + 2);
+	cmd_start(timeout, callback);
+	return(TRUE);
+}
+
+/*! Advance the command in progress.
+ *
+ * Consume all the bytes in the rx buffer, then tx as many bytes as
+ * the usart accepts. Never waits.
+ * The command fails once hal_millis() passes its deadline, on the
+ * AVR with HAL_NO_TIMER0 only the time in hal_delay_ms() is counted.
+ *
+ * \return the command state RFID_CMD_*.
+ */
+uint8_t rfid_cmd_poll(void)
+{
+	uint8_t c;
+
+	while ((rfid->state == RFID_CMD_RX) &&
+			usart_get(RFID_USART_PORT, &c, 1)) {
+		if (rx_byte(c)) {
+			LOG_FRAME(RFID_LOG_RX |
+					(rfid->error ? RFID_LOG_BADCRC : 0));
+			cmd_end(reply_ok());
+		}
 	}
 
-	if (!rfid->error) {
-		/* Set Current Tag Protocol (93h) [to Gen2]
-		 * ff02930005517d
-		 */
-		rfid->len = 0x02;
-		rfid->opcode = 0x93;
-		rfid->data[0] = 0;
-		rfid->data[1] = 0x05;
-		send_cmd();
-	}
-
-	if (!rfid->error) {
-		/* Set power mode (to min, it is off, but the tx still the same)
-		 * also it consume a lot less.
-		 * -> ff01980344be
-		 * <- ff009800008671
-		 */
-		rfid->len = 0x01;
-		rfid->opcode = 0x98;
-		rfid->data[0] = 0x03;
-		send_cmd();
+	/* after the rx, the callback may have submitted a new command */
+	if (rfid->state == RFID_CMD_TX) {
+		while ((rfid->idx < (rfid->len + 5)) && usart_txready(RFID_USART))
+			usart_putchar(RFID_USART, tx_byte(rfid->idx++));
+
+		if (rfid->idx == (rfid->len + 5)) {
+			usart_flush(RFID_USART);
+			rfid->idx = 0;
+			rfid->state = RFID_CMD_RX;
+			HIST_STAMP(RFID_HIST_THINK);
+		}
 	}
 
-#ifdef RFID_M5_LOWTXPWR
-	if (!rfid->error) {
-		/* set the tx (read) power to the minimum (03e8 from above)
-		 * -> ff029203e842b1
-		 * <- ff00920000273b
-		 */
-		rfid->len = 0x02;
-		rfid->opcode = 0x92;
-		rfid->data[0] = RFID_M5_TX_RDBM_H;
-		rfid->data[1] = RFID_M5_TX_RDBM_L;
-		send_cmd();
+	if (rfid_cmd_busy() &&
+			((int32_t)(hal_millis() - rfid->deadline) > 0)) {
+		LOG_FRAME(RFID_LOG_TIMEOUT);
+		cmd_end(FALSE);
 	}
-#endif
 
-	if (!rfid->error) {
-		/* Set the Reader config (max epc lenght) to 496 bits
-		 * > 9a 01 02 01
-		 * -> ff039a010201ad5c
-		 * <- ff009a0000a633
-		 */
-		rfid->len = 0x03;
-		rfid->opcode = 0x9a;
-		rfid->data[0] = 0x01;
-		rfid->data[1] = 0x02;
-		rfid->data[2] = 0x01;
-		send_cmd();
+	return(rfid->state);
+}
+
+/*! Abort the command in progress.
+ *
+ * The rx buffer is cleared, a late reply from the device can still
+ * arrive and it will be discarded by the next command's parser
+ * while it looks for the SOH.
+ */
+void rfid_cmd_cancel(void)
+{
+	if (rfid_cmd_busy()) {
+		rfid->state = RFID_CMD_IDLE;
+		usart_clear_rx_buffer(RFID_USART);
 	}
+}
 
-	free(rfid->data);
-	return(rfid->error);
+/*! Wait for the command in progress to end.
+ *
+ * \return TRUE command send and ack properly received.
+ */
+uint8_t cmd_wait(void)
+{
+	uint8_t s;
+
+	/* the tx is pushed without delay, only the reply is awaited */
+	while (((s = rfid_cmd_poll()) == RFID_CMD_TX) ||
+			(s == RFID_CMD_RX))
+		if (s == RFID_CMD_RX)
+			hal_delay_ms(RFID_POLL_MSEC);
+
+	return(s == RFID_CMD_DONE);
 }
 
-/*! Initialize the USART port and the rfid struct.
+/*! Send a command to the device and get the ACK/ANSWER
+ *
+ * Prepare the correct rfid field (SOH and CRC) the send it to
+ * the device, wait for the answer/ack and checkit.
+ *
+ * \return TRUE command send and ack properly received.
  */
-struct rfid_t* rfid_init(void)
+uint8_t send_cmd(void)
 {
-	rfid = malloc(sizeof(struct rfid_t));
-	rfid->usart = usart_init(RFID_USART_PORT);
-	rfid->size = RFID_SIZE;
+	TRACE(TRACE_CMD_SEND);
+	/* reply in RFID_CMD_TIMEOUT msec max */
+	rfid_cmd_submit(RFID_CMD_TIMEOUT, NULL);
+	return(cmd_wait());
+}
+
+/*! Send a constant frame and get the ACK/ANSWER
+ *
+ * \param frame the PROGMEM frame.
+ * \return TRUE command send and ack properly received.
+ */
+uint8_t send_cmd_P(const uint8_t *frame)
+{
+	TRACE(TRACE_CMD_SEND);
+	rfid_cmd_submit_P(frame, RFID_CMD_TIMEOUT, NULL);
+	return(cmd_wait());
+}
+
+/*! Send a setting only if it differs from the applied one.
+ *
+ * The CRC of the frame identifies the setting's value, if it
+ * matches the one in the cache the module already has it.
+ *
+ * \param slot the RFID_CFG_* setting.
+ * \param frame the PROGMEM frame.
+ * \return TRUE the setting is in place.
+ */
+uint8_t cfg_apply_P(const uint8_t slot, const uint8_t *frame)
+{
+	uint16_t crc16;
+	uint8_t len;
+
+	len = pgm_read_byte(frame + 1);
+	crc16 = ((uint16_t)pgm_read_byte(frame + len + 3) << 8) |
+		pgm_read_byte(frame + len + 4);
+
+	if (rfid->cfg[slot] == crc16)
+		return(TRUE);
+
+	if (send_cmd_P(frame))
+		rfid->cfg[slot] = crc16;
+	else
+		rfid->cfg[slot] = 0;
+
+#ifdef RFID_M5_CFG_EEPROM
+	eeprom_update_word(&ee_cfg[slot], rfid->cfg[slot]);
+#endif
+
+	return(rfid->cfg[slot] == crc16);
+}
+
+/*! Send the setting in rfid->opcode, len and data only if it
+ * differs from the applied one.
+ *
+ * \see cfg_apply_P()
+ * \param slot the RFID_CFG_* setting.
+ * \return TRUE the setting is in place.
+ */
+uint8_t cfg_apply(const uint8_t slot)
+{
+	uint16_t crc16;
+
+	crc16 = m5_crc(FALSE);
+
+	if (rfid->cfg[slot] == crc16)
+		return(TRUE);
+
+	if (send_cmd())
+		rfid->cfg[slot] = crc16;
+	else
+		rfid->cfg[slot] = 0;
+
+#ifdef RFID_M5_CFG_EEPROM
+	eeprom_update_word(&ee_cfg[slot], rfid->cfg[slot]);
+#endif
+
+	return(rfid->cfg[slot] == crc16);
+}
+
+/*! Forget the applied configuration.
+ *
+ * Must be called if the module is powered off, the next
+ * rfid_resume() will send all the settings.
+ */
+void rfid_cfg_clear(void)
+{
+	memset(rfid->cfg, 0, sizeof(rfid->cfg));
+	rfid->antenna = 0;
+
+#ifdef RFID_M5_CFG_EEPROM
+	eeprom_update_block(rfid->cfg, ee_cfg, sizeof(ee_cfg));
+#endif
+}
+
+/*! CRC of the read profile, full calculation.
+ */
+void profile_crc(void)
+{
+	uint8_t i;
+
+	rfid->profile.crc = 0xffff;
+	CRC_calcCrc8(&rfid->profile.crc, rfid->profile.len);
+	CRC_calcCrc8(&rfid->profile.crc, rfid->profile.opcode);
+
+	for (i = 0; i < rfid->profile.len; i++)
+		CRC_calcCrc8(&rfid->profile.crc, rfid->profile.data[i]);
+}
+
+/*! Patch a byte of the read profile.
+ *
+ * The CRC is linear, the change of a byte at a given position
+ * changes the CRC by the difference shifted through all the bytes
+ * following it, the rest of the frame is not scanned.
+ *
+ * \param pos the position in profile.data.
+ * \param c the new value.
+ */
+void profile_patch(const uint8_t pos, const uint8_t c)
+{
+	uint16_t delta;
+	uint8_t i;
+
+	delta = rfid->profile.data[pos] ^ c;
+
+	if (!delta)
+		return;
+
+	rfid->profile.data[pos] = c;
+
+	for (i = pos + 1; i < rfid->profile.len; i++)
+		delta = M5_CRC_STEP(delta, 0);
+
+	rfid->profile.crc ^= delta;
+}
+
+/*! Patch a big endian field of the read profile.
+ *
+ * \param pos the position in profile.data.
+ * \param value the new value.
+ * \param size the field size in byte.
+ */
+void profile_patch_be(const uint8_t pos, const uint32_t value,
+		const uint8_t size)
+{
+	uint8_t i;
+
+	for (i = 0; i < size; i++)
+		profile_patch(pos + i, (uint8_t)(value >> (8 * (size - 1 - i))));
+}
+
+/*! Encode the select filter.
+ *
+ * EPC: sel len(1) + sel data(N)
+ * TID, USER: sel addr(4) + sel len(1) + sel data(N)
+ *
+ * \param buf the area to write to.
+ * \param sel the filter.
+ * \return the number of bytes written.
+ */
+uint8_t select_encode(uint8_t *buf, const struct rfid_select_t *sel)
+{
+	uint8_t n, size;
+
+	n = 0;
+
+	if (!(sel->option & ~RFID_SEL_INVERT))
+		return(n);
+
+	if ((sel->option & ~RFID_SEL_INVERT) != RFID_SEL_EPC) {
+		buf[n++] = (uint8_t)(sel->address >> 24);
+		buf[n++] = (uint8_t)(sel->address >> 16);
+		buf[n++] = (uint8_t)(sel->address >> 8);
+		buf[n++] = (uint8_t)(sel->address & 0xff);
+	}
+
+	size = (sel->bits + 7) >> 3;
+	buf[n++] = sel->bits;
+	memcpy(buf + n, sel->mask, size);
+	return(n + size);
+}
+
+/*! Apply the select filter to the read profile.
+ *
+ * The filter takes the tail of the command, if the size does not
+ * change the frame is patched, otherwise it is encoded again.
+ */
+void profile_select(void)
+{
+	uint8_t tail[RFID_SELECT_SIZE + 5];
+	uint8_t i, n, pos, option;
+
+	n = select_encode(tail, &rfid->select);
+	option = rfid->select.option;
+
+	if (rfid->profile.opcode == 0x28) {
+		pos = RFID_PROFILE_SEL;
+
+		/* the password is always present */
+		if (!n)
+			option = RFID_SEL_PASSWORD;
+	} else {
+		pos = 3;
+
+		/* the metadata flags follow the option */
+		if (rfid->meta) {
+			option |= RFID_SEL_META;
+			pos = 5;
+		}
+
+		/* no select, short form */
+		if (!option) {
+			rfid->profile.len = 2;
+			profile_crc();
+			return;
+		}
+	}
+
+	if (rfid->profile.len == (pos + n)) {
+		profile_patch(2, option);
+
+		if (pos == 5)
+			profile_patch_be(3, rfid->meta, 2);
+
+		for (i = 0; i < n; i++)
+			profile_patch(pos + i, tail[i]);
+	} else {
+		rfid->profile.len = pos + n;
+		rfid->profile.data[2] = option;
+
+		if (pos == 5) {
+			rfid->profile.data[3] = (uint8_t)(rfid->meta >> 8);
+			rfid->profile.data[4] = (uint8_t)(rfid->meta & 0xff);
+		}
+
+		memcpy(rfid->profile.data + pos, tail, n);
+		profile_crc();
+	}
+}
+
+/*! Set the Gen2 select filter.
+ *
+ * Only the tags matching the filter (or not matching it with
+ * RFID_SEL_INVERT) are singulated by the reader, both by the read
+ * profile and by the inventory.
+ *
+ * \param sel the filter, NULL to remove it.
+ * \return FALSE the mask is too long.
+ */
+uint8_t rfid_select(const struct rfid_select_t *sel)
+{
+	if (!sel) {
+		rfid->select.option = RFID_SEL_NONE;
+	} else if (((sel->bits + 7) >> 3) > RFID_SELECT_SIZE) {
+		return(FALSE);
+	} else {
+		memcpy(&rfid->select, sel, sizeof(struct rfid_select_t));
+	}
+
+	profile_select();
+	return(TRUE);
+}
+
+/*! Set the metadata returned with the tags.
+ *
+ * Used by the EPC read profile and by the tag buffer.
+ *
+ * \param flags RFID_META_* without RFID_META_DATA, which follows
+ * rfid_embed().
+ */
+void rfid_metadata(const uint16_t flags)
+{
+	rfid->meta = flags & ~RFID_META_DATA;
+
+	if (rfid->profile.opcode == 0x21)
+		profile_select();
+}
+
+/*! Read the EPC of the 1st tag available (21h).
+ *
+ * ff022103e8d509
+ *
+ * With a select filter or metadata:
+ * > 21 [timeout] [option] [metadata flags(2)] [filter]
+ *
+ * \param timeout in msec, ex. 0x03e8 1 sec, 0x2710 10 sec.
+ */
+void rfid_profile_epc(const uint16_t timeout)
+{
+	rfid->profile.opcode = 0x21;
+	rfid->profile.len = 0x02;
+	rfid->profile.data[0] = (uint8_t)(timeout >> 8);
+	rfid->profile.data[1] = (uint8_t)(timeout & 0xff);
+	profile_select();
+}
+
+/*! Read the memory of a tag (28h).
+ *
+ * The access password is the one of rfid_password().
+ *
+ * # Read the EPC of a locked TAG
+ * cmd:                28 (read memory)
+ * Time out:           03e8
+ * Singulation Option: 02 (select singulation on TID)
+ * Read Membank:       01 (EPC)
+ * Read Address:       00000002 (starting from 2 word inside the EPC memory)
+ * Word count:         08 (16 Byte EPC lenght)
+ * Access code:        xxxxxxxx (to be changed!)
+ * Singulation addr:   00000000 (TID starting address)
+ * Signulation lenght: 08 bit (1 byte to match to select the tag)
+ * Singulation data:   e2 (select the tag with TID starting with e2)
+ *
+ * > 28 03e8 02 01 00000002 08 xxxxxxxx 00000000 08 e2
+ *
+ * \param timeout in msec.
+ * \param bank the memory bank.
+ * \param address the first word to read.
+ * \param count the number of words.
+ */
+void rfid_profile_data(const uint16_t timeout, const uint8_t bank,
+		const uint32_t address, const uint8_t count)
+{
+	rfid->profile.opcode = 0x28;
+	rfid->profile.len = RFID_PROFILE_SEL;
+	memset(rfid->profile.data, 0, RFID_PROFILE_SEL);
+	rfid->profile.data[0] = (uint8_t)(timeout >> 8);
+	rfid->profile.data[1] = (uint8_t)(timeout & 0xff);
+	rfid->profile.data[3] = bank;
+	rfid->profile.data[4] = (uint8_t)(address >> 24);
+	rfid->profile.data[5] = (uint8_t)(address >> 16);
+	rfid->profile.data[6] = (uint8_t)(address >> 8);
+	rfid->profile.data[7] = (uint8_t)(address & 0xff);
+	rfid->profile.data[8] = count;
+	rfid->profile.data[9] = (uint8_t)(rfid->password >> 24);
+	rfid->profile.data[10] = (uint8_t)(rfid->password >> 16);
+	rfid->profile.data[11] = (uint8_t)(rfid->password >> 8);
+	rfid->profile.data[12] = (uint8_t)(rfid->password & 0xff);
+	profile_select();
+}
+
+/*! Change the timeout of the read profile.
+ *
+ * \param timeout in msec.
+ */
+void rfid_profile_timeout(const uint16_t timeout)
+{
+	profile_patch_be(0, timeout, 2);
+}
+
+/*! Set the tag access password.
+ *
+ * Used by the read memory profile and by the bulk memory commands.
+ *
+ * \param password the tag access password.
+ */
+void rfid_password(const uint32_t password)
+{
+	rfid->password = password;
+
+	if (rfid->profile.opcode == 0x28)
+		profile_patch_be(9, password, 4);
+}
+
+/*! The default read profile.
+ *
+ * With RFID_M5_PASSWORD read the EPC of a locked tag with the
+ * singulation RFID_M5_SINGULATION on the TID, otherwise the EPC
+ * of the 1st tag available.
+ */
+void profile_default(void)
+{
+#ifdef RFID_M5_PASSWORD
+	static const uint8_t PROGMEM cmd_read[] = {
+		0x03, 0xe8,
+		0x02, 0x01, 0x00, 0x00,0x00,0x02,
+		0x08,
+		RFID_M5_PASSWORD,
+		0x00, 0x00, 0x00, 0x00,
+		RFID_M5_SINGULATION};
+
+	rfid->profile.len = sizeof(cmd_read);
+	rfid->profile.opcode = 0x28;
+	memcpy_P(rfid->profile.data, cmd_read, rfid->profile.len);
+	profile_crc();
+
+	/* the same password and filter are used by the other commands */
+	rfid->password = ((uint32_t)rfid->profile.data[9] << 24) |
+		((uint32_t)rfid->profile.data[10] << 16) |
+		((uint16_t)rfid->profile.data[11] << 8) |
+		rfid->profile.data[12];
+	rfid->select.option = RFID_SEL_TID;
+	rfid->select.address = 0;
+	rfid->select.bits = rfid->profile.data[RFID_PROFILE_SEL + 4];
+	memcpy(rfid->select.mask, rfid->profile.data + RFID_PROFILE_SEL + 5,
+			RFID_SELECT_SIZE);
+#else
+	rfid->password = 0;
+	rfid->select.option = RFID_SEL_NONE;
+	rfid_profile_epc(0x03e8);
+#endif
+}
+
+/*! Start reading the RFID code without waiting.
+ *
+ * The command is the read profile, it is copied as it is
+ * with its CRC.
+ *
+ * Proceed with rfid_cmd_poll() then collect the code with
+ * rfid_read_get().
+ *
+ * \return TRUE the command has been submitted.
+ */
+uint8_t rfid_read_submit(void)
+{
+	if (rfid_cmd_busy())
+		return(FALSE);
+
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+
+	if (!rfid->data)
+		return(FALSE);
+
+	usart_clear_rx_buffer(RFID_USART);
+	rfid->len = rfid->profile.len;
+	rfid->opcode = rfid->profile.opcode;
+	memcpy(rfid->data, rfid->profile.data, rfid->len);
+	rfid->frame = NULL;
+	rfid->soh = 0xff;
+	rfid->crc = rfid->profile.crc;
+	/* the device waits up to the timeout in the command */
+	cmd_start(RFID_CMD_TIMEOUT + (((uint16_t)rfid->data[0] << 8) |
+				rfid->data[1]), NULL);
+	return(TRUE);
+}
+
+/*! Decode the metadata fields of a tag.
+ *
+ * The fields are present in the order of the flags, the ones not
+ * requested are set to 0. Every field is checked against the end
+ * before it is read.
+ *
+ * \param p the first field.
+ * \param end the end of the reply.
+ * \param flags the metadata flags of the reply.
+ * \param view where to store the fields.
+ * \return the byte after the metadata, NULL if truncated.
+ */
+const uint8_t *meta_parse(const uint8_t *p, const uint8_t *end,
+		const uint16_t flags, struct rfid_view_t *view)
+{
+	uint16_t n;
+
+	view->count = 0;
+	view->rssi = 0;
+	view->antenna = 0;
+	view->freq = 0;
+	view->time = 0;
+	view->data_len = 0;
+
+	/* the fixed size fields before the data */
+	n = 0;
+
+	if (flags & RFID_META_COUNT)
+		n++;
+
+	if (flags & RFID_META_RSSI)
+		n++;
+
+	if (flags & RFID_META_ANTENNA)
+		n++;
+
+	if (flags & RFID_META_FREQ)
+		n += 3;
+
+	if (flags & RFID_META_TIME)
+		n += 4;
+
+	if (flags & RFID_META_PHASE)
+		n += 2;
+
+	if (flags & RFID_META_PROTOCOL)
+		n++;
+
+	if ((end - p) < n)
+		return(NULL);
+
+	if (flags & RFID_META_COUNT)
+		view->count = *p++;
+
+	if (flags & RFID_META_RSSI)
+		view->rssi = (int8_t)*p++;
+
+	if (flags & RFID_META_ANTENNA)
+		view->antenna = *p++;
+
+	if (flags & RFID_META_FREQ) {
+		view->freq = ((uint32_t)*p << 16) | ((uint16_t)*(p + 1) << 8) |
+			*(p + 2);
+		p += 3;
+	}
+
+	if (flags & RFID_META_TIME) {
+		view->time = ((uint32_t)*p << 24) | ((uint32_t)*(p + 1) << 16) |
+			((uint16_t)*(p + 2) << 8) | *(p + 3);
+		p += 4;
+	}
+
+	if (flags & RFID_META_PHASE)
+		p += 2;
+
+	if (flags & RFID_META_PROTOCOL)
+		p++;
+
+	if (flags & RFID_META_DATA) {
+		if ((end - p) < 2)
+			return(NULL);
+
+		/* the length is in bit */
+		n = ((((uint16_t)*p << 8) | *(p + 1)) + 7) >> 3;
+		p += 2;
+
+		if ((end - p) < n)
+			return(NULL);
+
+		view->data_len = n;
+		view->data = p;
+		p += n;
+	}
+
+	if (flags & RFID_META_GPIO) {
+		if (p >= end)
+			return(NULL);
+
+		p++;
+	}
+
+	return(p);
+}
+
+/*! Decode PC, EPC and CRC of a tag.
+ *
+ * \param p the PC word.
+ * \param size the bytes of PC, EPC and CRC.
+ * \param view where to store the fields.
+ * \return FALSE the size is too short.
+ */
+uint8_t epc_parse(const uint8_t *p, const uint8_t size,
+		struct rfid_view_t *view)
+{
+	if (size < 4)
+		return(FALSE);
+
+	view->pc = ((uint16_t)*p << 8) | *(p + 1);
+	view->epc = p + 2;
+	view->epc_len = size - 4;
+	return(TRUE);
+}
+
+/*! Copy a tag out of the reply.
+ *
+ * EPC and data exceeding the tag size are truncated.
+ *
+ * \param view the tag in the reply.
+ * \param tag where to copy the tag.
+ */
+void view_copy(const struct rfid_view_t *view, struct rfid_tag_t *tag)
+{
+	tag->epc_len = (view->epc_len < RFID_EPC_SIZE) ?
+		view->epc_len : RFID_EPC_SIZE;
+	memcpy(tag->epc, view->epc, tag->epc_len);
+	tag->pc = view->pc;
+	tag->rssi = view->rssi;
+	tag->antenna = view->antenna;
+	tag->freq = view->freq;
+	tag->count = view->count;
+	tag->time = view->time;
+	tag->data_len = (view->data_len < RFID_DATA_SIZE) ?
+		view->data_len : RFID_DATA_SIZE;
+
+	/* no embedded read, data is NULL */
+	if (tag->data_len)
+		memcpy(tag->data, view->data, tag->data_len);
+}
+
+/*! Decode the reply of rfid_read_submit().
+ *
+ * With rfid_metadata() the EPC read (21h) replies:
+ * < [option] [metadata flags(2)] [metadata] [PC(2)] [EPC] [CRC(2)]
+ * otherwise only the EPC is present.
+ * The read memory (28h) replies with the option byte and the
+ * words, they are seen as the EPC.
+ *
+ * \param view where to store the tag.
+ * \return TRUE the tag is present, FALSE no valid tag.
+ */
+uint8_t read_parse(struct rfid_view_t *view)
+{
+	const uint8_t *p, *end;
+
+	if (rfid->state != RFID_CMD_DONE)
+		return(FALSE);
+
+	end = rfid->data + rfid->len;
+
+	if ((rfid->profile.len > 2) && (rfid->profile.opcode == 0x21) &&
+			(rfid->profile.data[2] & RFID_SEL_META)) {
+		if (rfid->len < 3)
+			return(FALSE);
+
+		p = meta_parse(rfid->data + 3, end,
+				((uint16_t)rfid->data[1] << 8) | rfid->data[2],
+				view);
+		return(p && epc_parse(p, end - p, view));
+	}
+
+	meta_parse(rfid->data, end, 0, view);
+	view->pc = 0;
+	view->epc = rfid->data;
+	view->epc_len = rfid->len;
+
+	if (rfid->profile.opcode == 0x28) {
+		if (!rfid->len)
+			return(FALSE);
+
+		view->epc++;
+		view->epc_len--;
+	}
+
+	return(TRUE);
+}
+
+/*! Collect the tag read with rfid_read_submit().
+ *
+ * Must be called once for every rfid_read_submit() also if the
+ * command failed or it has been cancelled, it releases the buffer.
+ *
+ * \param tag where to store the tag.
+ * \return TRUE the tag is present, FALSE no valid tag.
+ */
+uint8_t rfid_read_tag_get(struct rfid_tag_t *tag)
+{
+	struct rfid_view_t view;
+	uint8_t ok;
+
+	ok = read_parse(&view);
+
+	if (ok)
+		view_copy(&view, tag);
+
+	free(rfid->data);
+	rfid->state = RFID_CMD_IDLE;
+	return(ok);
+}
+
+/*! Collect the RFID code read with rfid_read_submit().
+ *
+ * The EPC is copied up to rfid->size bytes, a shorter one is
+ * padded with 0.
+ *
+ * \see rfid_read_tag_get()
+ * \param data pre-allocated byte space, rfid->size bytes.
+ * \return TRUE rfid code is present, FALSE no valid code.
+ */
+uint8_t rfid_read_get(uint8_t *data)
+{
+	struct rfid_view_t view;
+	uint8_t ok, size;
+
+	ok = read_parse(&view);
+
+	if (ok) {
+		size = (view.epc_len < rfid->size) ? view.epc_len : rfid->size;
+		memcpy(data, view.epc, size);
+		memset(data + size, 0, rfid->size - size);
+	}
+
+	free(rfid->data);
+	rfid->state = RFID_CMD_IDLE;
+	return(ok);
+}
+
+/*! Get the RFID code.
+ *
+ * String size of the code is RFID size * 2 plus the CRC plus \0.
+ *
+ * \param data pre-allocated byte space.
+ * \return TRUE rfid code is present, FALSE no valid code.
+ */
+uint8_t rfid_read(uint8_t* data)
+{
+	if (!rfid_read_submit())
+		return(FALSE);
+
+	cmd_wait();
+	return(rfid_read_get(data));
+}
+
+/*! Read a tag with its metadata.
+ *
+ * \see rfid_metadata()
+ * \param tag where to store the tag.
+ * \return TRUE the tag is present, FALSE no valid tag.
+ */
+uint8_t rfid_read_tag(struct rfid_tag_t *tag)
+{
+	if (!rfid_read_submit())
+		return(FALSE);
+
+	cmd_wait();
+	return(rfid_read_tag_get(tag));
+}
+
+/*! Check a constant frame.
+ *
+ * \param frame the PROGMEM frame.
+ * \return TRUE the SOH and the CRC are correct.
+ */
+uint8_t frame_check(const uint8_t *frame)
+{
+	uint16_t crc16, i, len;
+
+	if (pgm_read_byte(frame) != 0xff)
+		return(FALSE);
+
+	len = pgm_read_byte(frame + 1);
+	crc16 = 0xffff;
+
+	/* len, opcode and data */
+	for (i = 1; i < (len + 3); i++)
+		CRC_calcCrc8(&crc16, pgm_read_byte(frame + i));
+
+	return(crc16 == (((uint16_t)pgm_read_byte(frame + len + 3) << 8) |
+				pgm_read_byte(frame + len + 4)));
+}
+
+/*! Check the constant frames.
+ *
+ * The CRC of every precomputed frame is calculated again with
+ * CRC_calcCrc8(), this validates both the compile time encoder
+ * and the flash content.
+ *
+ * \return TRUE all the frames are correct.
+ */
+uint8_t rfid_selftest(void)
+{
+	uint8_t ok;
+
+	ok = frame_check(m5_boot) && frame_check(m5_region) &&
+		frame_check(m5_region_get) && frame_check(m5_protocol) && frame_check(m5_power) &&
+		frame_check(m5_config) && frame_check(m5_tagbuf_clear);
+
+#ifdef RFID_M5_LOWTXPWR
+	ok = ok && frame_check(m5_txpwr);
+#endif
+
+	return(ok);
+}
+
+/*! Read tag memory in the inventory.
+ *
+ * Every tag found by rfid_inventory() is also read, the words are
+ * returned with the EPC by rfid_tagbuf().
+ *
+ * \param bank the memory bank.
+ * \param address the first word to read.
+ * \param count the number of words, 0 to disable.
+ */
+void rfid_embed(const uint8_t bank, const uint32_t address,
+		const uint8_t count)
+{
+	rfid->embed.bank = bank;
+	rfid->embed.address = address;
+	rfid->embed.count = count;
+}
+
+/*! Encode the multi tag inventory (22h).
+ *
+ * > 22 [option] [search flags(2)] [timeout(2)] [filter] [embedded]
+ *
+ * With rfid_embed() the search flag 0004h adds one embedded read
+ * memory command executed on every tag:
+ * > 01 (commands) 09 (len) 28 0000 00 [bank] [address(4)] [count]
+ *
+ * \param timeout the inventory time in msec.
+ */
+void inventory_encode(const uint16_t timeout)
+{
+	uint8_t *p;
+
+	rfid->opcode = 0x22;
+	rfid->data[0] = rfid->select.option;
+	rfid->data[1] = 0;
+	rfid->data[2] = 0;
+	rfid->data[3] = (uint8_t)(timeout >> 8);
+	rfid->data[4] = (uint8_t)(timeout & 0xff);
+	p = rfid->data + 5;
+	p += select_encode(p, &rfid->select);
+
+	if (rfid->embed.count) {
+		rfid->data[2] = 0x04;
+		*p++ = 0x01;
+		*p++ = 0x09;
+		*p++ = 0x28;
+		*p++ = 0;
+		*p++ = 0;
+		*p++ = 0;
+		*p++ = rfid->embed.bank;
+		*p++ = (uint8_t)(rfid->embed.address >> 24);
+		*p++ = (uint8_t)(rfid->embed.address >> 16);
+		*p++ = (uint8_t)(rfid->embed.address >> 8);
+		*p++ = (uint8_t)(rfid->embed.address & 0xff);
+		*p++ = rfid->embed.count;
+	}
+
+	rfid->len = p - rfid->data;
+}
+
+/*! Start a multi tag inventory without waiting (22h).
+ *
+ * The tags found, only the ones matching the select filter, are
+ * stored in the device tag buffer.
+ *
+ * Proceed with rfid_cmd_poll() then collect the result with
+ * rfid_inventory_get().
+ *
+ * \see inventory_encode()
+ * \param timeout the inventory time in msec.
+ * \return TRUE the command has been submitted.
+ */
+uint8_t rfid_inventory_submit(const uint16_t timeout)
+{
+	if (rfid_cmd_busy())
+		return(FALSE);
+
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+
+	if (!rfid->data)
+		return(FALSE);
+
+	TRACE(TRACE_INV_START);
+	usart_clear_rx_buffer(RFID_USART);
+	inventory_encode(timeout);
+	return(rfid_cmd_submit(RFID_CMD_TIMEOUT + timeout,
+				NULL));
+}
+
+/*! The number of tags in the inventory reply.
+ *
+ * < [option] [search flags(2)] [count] [embedded results]
+ */
+uint8_t inventory_count(void)
+{
+	if ((rfid->state == RFID_CMD_DONE) && (rfid->len > 3))
+		return(*(rfid->data + 3));
+
+	/* short reply, only the count */
+	if ((rfid->state == RFID_CMD_DONE) && rfid->len)
+		return(*(rfid->data + rfid->len - 1));
+
+	return(0);
+}
+
+/*! Collect the result of rfid_inventory_submit().
+ *
+ * Must be called once for every rfid_inventory_submit(), it
+ * releases the buffer.
+ *
+ * \return the number of tags found.
+ */
+uint8_t rfid_inventory_get(void)
+{
+	uint8_t count;
+
+	count = inventory_count();
+	TRACE(TRACE_INV_END);
+	free(rfid->data);
+	rfid->state = RFID_CMD_IDLE;
+	return(count);
+}
+
+/*! Multi tag inventory.
+ *
+ * \param timeout the inventory time in msec.
+ * \return the number of tags found.
+ */
+uint8_t rfid_inventory(const uint16_t timeout)
+{
+	if (!rfid_inventory_submit(timeout))
+		return(0);
+
+	cmd_wait();
+	return(rfid_inventory_get());
+}
+
+/*! Start the fetch of the device tag buffer without waiting (29h).
+ *
+ * > 29 [metadata flags(2)] [read option]
+ *
+ * The metadata of rfid_metadata() are requested, if rfid_embed()
+ * is active the data read too.
+ * Proceed with rfid_cmd_poll() then collect the tags with
+ * rfid_tagbuf_get() or walk them with rfid_tagbuf_first().
+ *
+ * \return TRUE the command has been submitted.
+ */
+uint8_t rfid_tagbuf_submit(void)
+{
+	uint16_t flags;
+
+	if (rfid_cmd_busy())
+		return(FALSE);
+
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+
+	if (!rfid->data)
+		return(FALSE);
+
+	flags = rfid->meta;
+
+	if (rfid->embed.count)
+		flags |= RFID_META_DATA;
+
+	usart_clear_rx_buffer(RFID_USART);
+	rfid->opcode = 0x29;
+	rfid->len = 3;
+	rfid->data[0] = (uint8_t)(flags >> 8);
+	rfid->data[1] = (uint8_t)(flags & 0xff);
+	rfid->data[2] = 0;
+	return(rfid_cmd_submit(RFID_CMD_TIMEOUT, NULL));
+}
+
+/*! Decode a tag record of the tag buffer.
+ *
+ * The metadata fields, then the EPC length in bit (PC, EPC and CRC
+ * included), PC, EPC and CRC.
+ *
+ * \param p the record.
+ * \param end the end of the reply.
+ * \param flags the metadata flags of the reply.
+ * \param view where to store the tag.
+ * \return the next record, NULL if the record is truncated.
+ */
+const uint8_t *tag_parse(const uint8_t *p, const uint8_t *end,
+		const uint16_t flags, struct rfid_view_t *view)
+{
+	uint16_t size;
+
+	p = meta_parse(p, end, flags, view);
+
+	if (!p || ((p + 2) > end))
+		return(NULL);
+
+	size = (((uint16_t)*p << 8) | *(p + 1)) >> 3;
+	p += 2;
+
+	if (((p + size) > end) || !epc_parse(p, size, view))
+		return(NULL);
+
+	return(p + size);
+}
+
+/*! Start walking the tags of rfid_tagbuf_submit().
+ *
+ * The records are decoded in place in the reply, nothing is copied.
+ * The views are valid until rfid_tagbuf_end().
+ *
+ * < [metadata flags(2)] [read option] [count] [records]
+ *
+ * \param iter the iterator.
+ * \return the number of tags in the reply.
+ */
+uint8_t rfid_tagbuf_first(struct rfid_iter_t *iter)
+{
+	iter->left = 0;
+
+	if ((rfid->state == RFID_CMD_DONE) && (rfid->len > 3)) {
+		iter->flags = ((uint16_t)rfid->data[0] << 8) | rfid->data[1];
+		iter->left = rfid->data[3];
+		iter->p = rfid->data + 4;
+		iter->end = rfid->data + rfid->len;
+	}
+
+	return(iter->left);
+}
+
+/*! Next tag of the reply.
+ *
+ * \param iter the iterator.
+ * \param view where to store the tag.
+ * \return FALSE no more tags or the record is truncated.
+ */
+uint8_t rfid_tagbuf_next(struct rfid_iter_t *iter, struct rfid_view_t *view)
+{
+	if (!iter->left)
+		return(FALSE);
+
+	TRACE(TRACE_INV_TAG);
+	iter->p = tag_parse(iter->p, iter->end, iter->flags, view);
+
+	if (iter->p)
+		iter->left--;
+	else
+		iter->left = 0;
+
+	return(iter->p != NULL);
+}
+
+/*! Close the tag buffer reply.
+ *
+ * Must be called once for every rfid_tagbuf_submit(), it
+ * releases the buffer.
+ */
+void rfid_tagbuf_end(void)
+{
+	free(rfid->data);
+	rfid->state = RFID_CMD_IDLE;
+}
+
+/*! Collect the tags of rfid_tagbuf_submit().
+ *
+ * Must be called once for every rfid_tagbuf_submit(), it
+ * releases the buffer.
+ *
+ * \param tags the array where to copy the tags.
+ * \param size the number of elements of tags.
+ * \return the number of tags copied.
+ */
+uint8_t rfid_tagbuf_get(struct rfid_tag_t *tags, const uint8_t size)
+{
+	struct rfid_iter_t iter;
+	struct rfid_view_t view;
+	uint8_t i;
+
+	i = 0;
+	rfid_tagbuf_first(&iter);
+
+	while ((i < size) && rfid_tagbuf_next(&iter, &view))
+		view_copy(&view, tags + i++);
+
+	rfid_tagbuf_end();
+	return(i);
+}
+
+/*! Fetch the tags found by the inventory.
+ *
+ * \param tags the array where to copy the tags.
+ * \param size the number of elements of tags.
+ * \return the number of tags copied.
+ */
+uint8_t rfid_tagbuf(struct rfid_tag_t *tags, const uint8_t size)
+{
+	if (!rfid_tagbuf_submit())
+		return(0);
+
+	cmd_wait();
+	return(rfid_tagbuf_get(tags, size));
+}
+
+/*! Empty the device tag buffer (2Ah).
+ *
+ * \return TRUE the buffer is clear.
+ */
+uint8_t rfid_tagbuf_clear(void)
+{
+	uint8_t ok;
+
+	if (rfid_cmd_busy())
+		return(FALSE);
+
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+
+	if (!rfid->data)
+		return(FALSE);
+
+	ok = send_cmd_P(m5_tagbuf_clear);
+	free(rfid->data);
+	rfid->state = RFID_CMD_IDLE;
+	return(ok);
+}
+
+/*! Set Antenna Port (91h).
+ *
+ * > 91 [tx port] [rx port]
+ *
+ * The same (monostatic) port is used to tx and rx.
+ *
+ * \param port the antenna port, from 1.
+ * \return TRUE the port is in use.
+ */
+uint8_t rfid_antenna(const uint8_t port)
+{
+	uint8_t ok;
+
+	if (rfid->antenna == port)
+		return(TRUE);
+
+	if (rfid_cmd_busy())
+		return(FALSE);
+
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+
+	if (!rfid->data)
+		return(FALSE);
+
+	rfid->opcode = 0x91;
+	rfid->len = 2;
+	rfid->data[0] = port;
+	rfid->data[1] = port;
+	ok = send_cmd();
+	rfid->antenna = ok ? port : 0;
+	free(rfid->data);
+	rfid->state = RFID_CMD_IDLE;
+	return(ok);
+}
+
+/*! Remove all the antennas from the scheduler. */
+void rfid_antenna_reset(void)
+{
+	rfid->sched.count = 0;
+	rfid->sched.idx = 0;
+}
+
+/*! Add an antenna to the scheduler.
+ *
+ * The dwell is only the initial one, it adapts to the tags
+ * found on the antenna within RFID_ANT_DWELL_MIN and
+ * RFID_ANT_DWELL_MAX.
+ *
+ * \param port the antenna port.
+ * \param dwell the inventory time in msec.
+ * \param weight the share of the rounds, 0 to skip the antenna.
+ * \return FALSE no room for more antennas.
+ */
+uint8_t rfid_antenna_add(const uint8_t port, const uint16_t dwell,
+		const uint8_t weight)
+{
+	struct rfid_ant_t *ant;
+
+	if (rfid->sched.count == RFID_ANT_SIZE)
+		return(FALSE);
+
+	ant = rfid->sched.ant + rfid->sched.count++;
+	ant->port = port;
+	ant->weight = weight;
+	ant->credit = 0;
+	ant->last = 0;
+	ant->rounds = 0;
+	ant->tags = 0;
+
+	if (dwell < RFID_ANT_DWELL_MIN)
+		ant->dwell = RFID_ANT_DWELL_MIN;
+	else if (dwell > RFID_ANT_DWELL_MAX)
+		ant->dwell = RFID_ANT_DWELL_MAX;
+	else
+		ant->dwell = dwell;
+
+	return(TRUE);
+}
+
+/*! Pick the antenna of the next round.
+ *
+ * Smooth weighted round robin, every antenna earns its weight and
+ * the richest one pays the total, the rounds of an antenna are
+ * spread instead of clustered.
+ *
+ * \return FALSE no antenna with a weight.
+ */
+uint8_t ant_pick(void)
+{
+	struct rfid_ant_t *ant;
+	uint8_t i, best;
+	int16_t total;
+
+	total = 0;
+	best = 0;
+
+	for (i = 0; i < rfid->sched.count; i++) {
+		ant = rfid->sched.ant + i;
+		ant->credit += ant->weight;
+		total += ant->weight;
+
+		if (ant->credit > rfid->sched.ant[best].credit)
+			best = i;
+	}
+
+	if (!total)
+		return(FALSE);
+
+	rfid->sched.ant[best].credit -= total;
+	rfid->sched.idx = best;
+	return(TRUE);
+}
+
+/*! Adapt the dwell to the yield of the round.
+ *
+ * The dwell grows quickly where tags are found and shrinks slowly
+ * where the field is empty.
+ *
+ * \param ant the antenna of the round.
+ * \param count the tags found.
+ */
+void ant_adapt(struct rfid_ant_t *ant, const uint8_t count)
+{
+	uint16_t dwell;
+
+	ant->last = count;
+	ant->rounds++;
+	ant->tags += count;
+
+	if (count) {
+		dwell = ant->dwell + (ant->dwell >> 1);
+
+		if (dwell > RFID_ANT_DWELL_MAX)
+			dwell = RFID_ANT_DWELL_MAX;
+	} else {
+		dwell = ant->dwell - (ant->dwell >> 2);
+
+		if (dwell < RFID_ANT_DWELL_MIN)
+			dwell = RFID_ANT_DWELL_MIN;
+	}
+
+	ant->dwell = dwell;
+}
+
+/*! The inventory of the scheduled round is over. */
+void ant_round(const uint8_t ok)
+{
+	ant_adapt(rfid->sched.ant + rfid->sched.idx, inventory_count());
+
+	if (rfid->sched.callback)
+		rfid->sched.callback(ok);
+}
+
+/*! Start the inventory on the scheduled antenna.
+ *
+ * \param ok the Set Antenna Port result.
+ */
+void ant_inventory(const uint8_t ok)
+{
+	struct rfid_ant_t *ant;
+
+	ant = rfid->sched.ant + rfid->sched.idx;
+
+	if (ok) {
+		rfid->antenna = ant->port;
+		inventory_encode(ant->dwell);
+		rfid_cmd_submit(RFID_CMD_TIMEOUT + ant->dwell,
+				ant_round);
+	} else {
+		rfid->antenna = 0;
+
+		if (rfid->sched.callback)
+			rfid->sched.callback(FALSE);
+	}
+}
+
+/*! Start an inventory round on the next antenna without waiting.
+ *
+ * The antenna is chosen by weight, the port is switched if needed
+ * then the inventory runs for the antenna's dwell.
+ * Proceed with rfid_cmd_poll() then collect the result with
+ * rfid_inventory_get(), the antenna is rfid->sched.idx.
+ *
+ * \param callback called at the end of the round, can be NULL.
+ * \return TRUE the round has been submitted.
+ */
+uint8_t rfid_antenna_submit(void (*callback)(const uint8_t ok))
+{
+	struct rfid_ant_t *ant;
+
+	if (rfid_cmd_busy())
+		return(FALSE);
+
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+
+	if (!rfid->data)
+		return(FALSE);
+
+	/* the credits are spent only on a round that starts */
+	if (!ant_pick()) {
+		free(rfid->data);
+		return(FALSE);
+	}
+
+	usart_clear_rx_buffer(RFID_USART);
+	rfid->sched.callback = callback;
+	ant = rfid->sched.ant + rfid->sched.idx;
+
+	if (rfid->antenna == ant->port) {
+		ant_inventory(TRUE);
+	} else {
+		rfid->opcode = 0x91;
+		rfid->len = 2;
+		rfid->data[0] = ant->port;
+		rfid->data[1] = ant->port;
+		rfid_cmd_submit(RFID_CMD_TIMEOUT, ant_inventory);
+	}
+
+	return(TRUE);
+}
+
+/*! Inventory round on the next antenna.
+ *
+ * \return the number of tags found.
+ */
+uint8_t rfid_antenna_round(void)
+{
+	if (!rfid_antenna_submit(NULL))
+		return(0);
+
+	cmd_wait();
+	return(rfid_inventory_get());
+}
+
+/*! Read power in centi-dBm of a power in mW.
+ *
+ * dBm = 10log(mW), the log2 is calculated bit by bit by squaring
+ * the mantissa, then log10(x) = log2(x) * 0.30103.
+ * 60mW gives 1778 (0x06f2).
+ *
+ * \param mw the power in mW.
+ * \return the power in centi-dBm, 0 for 0mW.
+ */
+uint16_t rfid_power_cdbm(const uint16_t mw)
+{
+	uint32_t x;
+	uint16_t log2;
+	uint8_t i;
+
+	if (!mw)
+		return(0);
+
+	/* integer part */
+	log2 = 15;
+
+	while (!(mw & (1U << log2)))
+		log2--;
+
+	/* mantissa in [1, 2) Q15 */
+	x = (uint32_t)mw << (15 - log2);
+	log2 <<= 8;
+
+	for (i = 0x80; i; i >>= 1) {
+		x = (x * x) >> 15;
+
+		if (x >= 0x10000UL) {
+			x >>= 1;
+			log2 |= i;
+		}
+	}
+
+	/* 1000 * 0.30103 / 256 */
+	return(((uint32_t)log2 * 30103UL + 12800) / 25600);
+}
+
+/*! Send the read power if it differs from the applied one.
+ *
+ * Cached as the settings of rfid_resume(), rfid->data must be
+ * already allocated.
+ *
+ * > 92 [power(2)]
+ *
+ * \param cdbm the power in centi-dBm.
+ * \return TRUE the power is in place.
+ */
+uint8_t power_apply(const uint16_t cdbm)
+{
+	rfid->opcode = 0x92;
+	rfid->len = 2;
+	rfid->data[0] = (uint8_t)(cdbm >> 8);
+	rfid->data[1] = (uint8_t)(cdbm & 0xff);
+	return(cfg_apply(RFID_CFG_TXPWR));
+}
+
+/*! Set the read power (92h).
+ *
+ * The power is kept across rfid_resume() instead of the
+ * RFID_M5_LOWTXPWR one.
+ *
+ * \param cdbm the power in centi-dBm, see RFID_DBM().
+ * \return TRUE the power is in place, FALSE the previous one is
+ * kept.
+ */
+uint8_t rfid_power(const uint16_t cdbm)
+{
+	uint8_t ok;
+
+	if (rfid_cmd_busy())
+		return(FALSE);
+
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+
+	if (!rfid->data)
+		return(FALSE);
+
+	ok = power_apply(cdbm);
+
+	if (ok)
+		rfid->power.cdbm = cdbm;
+
+	free(rfid->data);
+	rfid->state = RFID_CMD_IDLE;
+	return(ok);
+}
+
+/*! Enable the read power control.
+ *
+ * The power starts in the middle of the bounds and it is
+ * adjusted by rfid_power_update() after every round.
+ *
+ * \param min the lowest power in centi-dBm.
+ * \param max the highest power in centi-dBm.
+ * \param step the adjustment in centi-dBm.
+ * \param tags the set-point, fewer tags found rise the power.
+ * \param rssi the highest RSSI in dBm, a stronger one is seen as
+ * cross-reads and lowers the power.
+ * \return TRUE the initial power is in place.
+ */
+uint8_t rfid_power_ctl(const uint16_t min, const uint16_t max,
+		const uint16_t step, const uint8_t tags, const int8_t rssi)
+{
+	rfid->power.min = min;
+	rfid->power.max = max;
+	rfid->power.step = step;
+	rfid->power.tags = tags;
+	rfid->power.rssi = rssi;
+	rfid->power.ctl = TRUE;
+	return(rfid_power(min + ((max - min) >> 1)));
+}
+
+/*! Adjust the read power from the last round.
+ *
+ * - fewer tags than the set-point, the power is too low: step up.
+ * - enough tags but a too strong RSSI, tags out of the zone are
+ *   read too: step down.
+ * - otherwise the power is kept.
+ *
+ * Without rfid_power_ctl() the power is never changed.
+ *
+ * \param count the tags found in the round.
+ * \param rssi the strongest RSSI in dBm of the round,
+ * RFID_RSSI_NONE if not known.
+ * \return the power in centi-dBm.
+ */
+uint16_t rfid_power_update(const uint8_t count, const int8_t rssi)
+{
+	uint16_t cdbm;
+
+	if (!rfid->power.ctl)
+		return(rfid->power.cdbm);
+
+	cdbm = rfid->power.cdbm;
+
+	if (count < rfid->power.tags) {
+		if ((rfid->power.max - cdbm) > rfid->power.step)
+			cdbm += rfid->power.step;
+		else
+			cdbm = rfid->power.max;
+	} else if ((rssi != RFID_RSSI_NONE) && (rssi > rfid->power.rssi)) {
+		if ((cdbm - rfid->power.min) > rfid->power.step)
+			cdbm -= rfid->power.step;
+		else
+			cdbm = rfid->power.min;
+	}
+
+	if (cdbm != rfid->power.cdbm)
+		rfid_power(cdbm);
+
+	return(rfid->power.cdbm);
+}
+
+/*! Send a Gen2 parameter (9Bh).
+ *
+ * > 9b 05 [parameter] [value]
+ *
+ * Parameters: 00 session, 01 target, 02 tag encoding, 10 link
+ * frequency, 11 tari, 12 Q, 13 BAP.
+ *
+ * \param slot the RFID_CFG_* setting.
+ * \param param the Gen2 parameter.
+ * \param value RFID_GEN2_DEFAULT is not sent.
+ * \return TRUE the parameter is in place.
+ */
+uint8_t gen2_param(const uint8_t slot, const uint8_t param,
+		const uint8_t value)
+{
+	if (value == RFID_GEN2_DEFAULT)
+		return(TRUE);
+
+	rfid->opcode = 0x9b;
+	rfid->len = 3;
+	rfid->data[0] = 0x05;
+	rfid->data[1] = param;
+	rfid->data[2] = value;
+
+	/* Q: 00 dynamic or 01 [Q] static */
+	if (param == 0x12) {
+		if (value == RFID_GEN2_Q_DYNAMIC) {
+			rfid->data[2] = 0;
+		} else {
+			rfid->data[2] = 1;
+			rfid->data[3] = value;
+			rfid->len = 4;
+		}
+	}
+
+	return(cfg_apply(slot));
+}
+
+/*! Send the Gen2 configuration, rfid->data must be already
+ * allocated.
+ *
+ * \return TRUE all the parameters are in place.
+ */
+uint8_t gen2_apply(void)
+{
+	uint8_t ok;
+
+	ok = gen2_param(RFID_CFG_SESSION, 0x00, rfid->gen2.session);
+	ok = ok && gen2_param(RFID_CFG_TARGET, 0x01, rfid->gen2.target);
+	ok = ok && gen2_param(RFID_CFG_ENCODING, 0x02, rfid->gen2.encoding);
+	ok = ok && gen2_param(RFID_CFG_BLF, 0x10, rfid->gen2.blf);
+	ok = ok && gen2_param(RFID_CFG_TARI, 0x11, rfid->gen2.tari);
+	ok = ok && gen2_param(RFID_CFG_Q, 0x12, rfid->gen2.q);
+	return(ok);
+}
+
+/*! Set the Gen2 configuration.
+ *
+ * The fields set to RFID_GEN2_DEFAULT are left to the firmware,
+ * the others are kept across rfid_resume().
+ *
+ * \param gen2 the configuration, the tune field enables
+ * rfid_gen2_tune().
+ * \return TRUE the configuration is in place.
+ */
+uint8_t rfid_gen2(const struct rfid_gen2_t *gen2)
+{
+	uint8_t ok;
+
+	if (rfid_cmd_busy())
+		return(FALSE);
+
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+
+	if (!rfid->data)
+		return(FALSE);
+
+	memcpy(&rfid->gen2, gen2, sizeof(struct rfid_gen2_t));
+	ok = gen2_apply();
+	free(rfid->data);
+	rfid->state = RFID_CMD_IDLE;
+	return(ok);
+}
+
+/*! Pick Q from the tags found.
+ *
+ * A round of 2^Q slots is most efficient when it has about as
+ * many slots as the tags replying. The population is a running
+ * average of the tags found (x16), Q is the smallest one with
+ * at least that many slots.
+ *
+ * \param count the tags found in the last round.
+ * \return the Q in use.
+ */
+uint8_t rfid_gen2_tune(const uint8_t count)
+{
+	struct rfid_gen2_t gen2;
+	uint16_t slots;
+	uint8_t q;
+
+	if (!rfid->gen2.tune)
+		return(rfid->gen2.q);
+
+	rfid->gen2.pop += ((int16_t)((uint16_t)count << 4) -
+			(int16_t)rfid->gen2.pop) >> 2;
+	slots = (rfid->gen2.pop + 15) >> 4;
+	q = 0;
+
+	while ((q < 15) && ((1U << q) < slots))
+		q++;
+
+	if (q != rfid->gen2.q) {
+		memcpy(&gen2, &rfid->gen2, sizeof(struct rfid_gen2_t));
+		gen2.q = q;
+		rfid_gen2(&gen2);
+	}
+
+	return(rfid->gen2.q);
+}
+
+/*! Enable the adaptive inventory duration.
+ *
+ * \param base the fixed duration it replaces in msec, the first
+ * round uses it.
+ * \param min the shortest round in msec.
+ * \param max the longest round in msec.
+ */
+void rfid_round_ctl(const uint16_t base, const uint16_t min,
+		const uint16_t max)
+{
+	rfid->round.base = base;
+	rfid->round.min = min;
+	rfid->round.max = max;
+	rfid->round.duration = base;
+	rfid->round.count = 0;
+	rfid->round.last = 0;
+	rfid->round.rounds = 0;
+	rfid->round.time = 0;
+	rfid->round.tags = 0;
+}
+
+/*! Choose the next round duration from the last one.
+ *
+ * The yield curve is summarized by when the last tag has been
+ * found, RFID_META_TIME:
+ * - no tags, the field is quiet: half the time.
+ * - tags still found in the last quarter: 1.5 times.
+ * - otherwise 1.5 times the last tag time, at most halved.
+ *
+ * \param count the tags found in the round.
+ * \param last msec from the start of the round of the last tag.
+ * \return the next round duration in msec.
+ */
+uint16_t rfid_round_update(const uint8_t count, const uint16_t last)
+{
+	uint32_t next;
+	uint16_t d;
+
+	d = rfid->round.duration;
+	rfid->round.count = count;
+	rfid->round.last = last;
+	rfid->round.rounds++;
+	rfid->round.time += d;
+	rfid->round.tags += count;
+
+	if (!count)
+		next = d >> 1;
+	else if (last >= (d - (d >> 2)))
+		next = (uint32_t)d + (d >> 1);
+	else if ((last + (last >> 1)) > (d >> 1))
+		next = last + (last >> 1);
+	else
+		next = d >> 1;
+
+	if (next < rfid->round.min)
+		next = rfid->round.min;
+
+	if (next > rfid->round.max)
+		next = rfid->round.max;
+
+	rfid->round.duration = next;
+	return(rfid->round.duration);
+}
+
+/*! Read time saved by the adaptive duration.
+ *
+ * \return msec saved compared to rounds of the base duration,
+ * negative if more time has been spent.
+ */
+int32_t rfid_round_saved(void)
+{
+	return((int32_t)rfid->round.rounds * rfid->round.base -
+			(int32_t)rfid->round.time);
+}
+
+/*! Inventory round of adaptive duration.
+ *
+ * The inventory runs for the duration chosen from the previous
+ * round, the tags are fetched with their time and the device tag
+ * buffer is cleared for the next round. A reply holds up to 255
+ * bytes, the fetch is repeated until the reader has no tags left.
+ * With a hop table the tags are counted on their channel, see
+ * rfid_hop_count().
+ *
+ * \param tags the array where to copy the tags, can be NULL.
+ * \param size the number of elements of tags.
+ * \return the number of tags found.
+ */
+uint8_t rfid_round(struct rfid_tag_t *tags, const uint8_t size)
+{
+	struct rfid_iter_t iter;
+	struct rfid_view_t view;
+	uint16_t meta, last;
+	uint8_t count, i, n;
+
+	count = rfid_inventory(rfid->round.duration);
+	last = 0;
+	i = 0;
+
+	if (count) {
+		meta = rfid->meta;
+		rfid->meta |= RFID_META_TIME;
+
+		if (rfid->hop.count)
+			rfid->meta |= RFID_META_FREQ;
+
+		do {
+			if (!rfid_tagbuf_submit())
+				break;
+
+			cmd_wait();
+			n = rfid_tagbuf_first(&iter);
+
+			while (rfid_tagbuf_next(&iter, &view)) {
+				if (view.time > last)
+					last = view.time;
+
+				rfid_hop_count(&view);
+
+				if (tags && (i < size))
+					view_copy(&view, tags + i++);
+			}
+
+			rfid_tagbuf_end();
+		} while (n);
+
+		rfid->meta = meta;
+		rfid_tagbuf_clear();
+	}
+
+	rfid_round_update(count, last);
+	return(count);
+}
+
+/*! Send the region, hop table and hop time of rfid_region(),
+ * rfid->data must be already allocated.
+ *
+ * > 97 [region]
+ * > 95 [frequency kHz(4)] ...
+ * > 95 01 [hop time msec(4)]
+ *
+ * An empty table is never sent, to drop the table applied the
+ * region is sent again, which restores its own.
+ *
+ * \return TRUE all in place.
+ */
+uint8_t hop_apply(void)
+{
+	uint8_t *p, i, ok;
+
+	ok = TRUE;
+
+	if (!rfid->hop.count && rfid->cfg[RFID_CFG_HOPTABLE]) {
+		rfid->cfg[RFID_CFG_REGION] = 0;
+		rfid->cfg[RFID_CFG_HOPTABLE] = 0;
+		rfid->cfg[RFID_CFG_HOPTIME] = 0;
+	}
+
+	if (rfid->hop.region) {
+		rfid->opcode = 0x97;
+		rfid->len = 1;
+		rfid->data[0] = rfid->hop.region;
+		ok = cfg_apply(RFID_CFG_REGION);
+	} else {
+		ok = cfg_apply_P(RFID_CFG_REGION, m5_region);
+	}
+
+	if (ok && rfid->hop.count) {
+		rfid->opcode = 0x95;
+		rfid->len = rfid->hop.count << 2;
+		p = rfid->data;
+
+		for (i = 0; i < rfid->hop.count; i++) {
+			*p++ = (uint8_t)(rfid->hop.freq[i] >> 24);
+			*p++ = (uint8_t)(rfid->hop.freq[i] >> 16);
+			*p++ = (uint8_t)(rfid->hop.freq[i] >> 8);
+			*p++ = (uint8_t)(rfid->hop.freq[i] & 0xff);
+		}
+
+		ok = cfg_apply(RFID_CFG_HOPTABLE);
+	}
+
+	if (ok && rfid->hop.time) {
+		rfid->opcode = 0x95;
+		rfid->len = 5;
+		rfid->data[0] = 0x01;
+		rfid->data[1] = (uint8_t)(rfid->hop.time >> 24);
+		rfid->data[2] = (uint8_t)(rfid->hop.time >> 16);
+		rfid->data[3] = (uint8_t)(rfid->hop.time >> 8);
+		rfid->data[4] = (uint8_t)(rfid->hop.time & 0xff);
+		ok = cfg_apply(RFID_CFG_HOPTIME);
+	}
+
+	return(ok);
+}
+
+/*! Send the hop configuration.
+ */
+uint8_t hop_send(void)
+{
+	uint8_t ok;
+
+	if (rfid_cmd_busy())
+		return(FALSE);
+
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+
+	if (!rfid->data)
+		return(FALSE);
+
+	ok = hop_apply();
+	free(rfid->data);
+	rfid->state = RFID_CMD_IDLE;
+	return(ok);
+}
+
+/*! Set the region (97h).
+ *
+ * The region resets the hop table and time of the firmware, the
+ * ones set with rfid_hop_table() and rfid_hop_time() are sent
+ * again. It is kept across rfid_resume() instead of the default.
+ *
+ * \param region RFID_REGION_*.
+ * \return TRUE the region is in place.
+ */
+uint8_t rfid_region(const uint8_t region)
+{
+	if (region != rfid->hop.region) {
+		rfid->hop.region = region;
+		rfid->cfg[RFID_CFG_HOPTABLE] = 0;
+		rfid->cfg[RFID_CFG_HOPTIME] = 0;
+	}
+
+	return(hop_send());
+}
+
+/*! Set the frequency hop table (95h).
+ *
+ * The channel counters restart.
+ *
+ * \param freq the channels in kHz.
+ * \param count the number of channels, up to RFID_HOP_SIZE,
+ * 0 to restore the region's table.
+ * \return TRUE the table is in place.
+ */
+uint8_t rfid_hop_table(const uint32_t *freq, const uint8_t count)
+{
+	if (count > RFID_HOP_SIZE)
+		return(FALSE);
+
+	memcpy(rfid->hop.freq, freq, count << 2);
+	memset(rfid->hop.reads, 0, sizeof(rfid->hop.reads));
+	rfid->hop.count = count;
+	return(hop_send());
+}
+
+/*! Set the hop time (95h 01).
+ *
+ * \param msec the time on every channel, 0 to keep the region's
+ * one.
+ * \return TRUE the hop time is in place.
+ */
+uint8_t rfid_hop_time(const uint32_t msec)
+{
+	rfid->hop.time = msec;
+	return(hop_send());
+}
+
+/*! Count a tag read on its channel.
+ *
+ * The tags must be read with RFID_META_FREQ, the ones on a
+ * frequency out of the table are ignored.
+ *
+ * \param view the tag.
+ */
+void rfid_hop_count(const struct rfid_view_t *view)
+{
+	uint8_t i;
+
+	for (i = 0; i < rfid->hop.count; i++)
+		if (rfid->hop.freq[i] == view->freq) {
+			if (rfid->hop.reads[i] < 0xffff)
+				rfid->hop.reads[i]++;
+
+			return;
+		}
+}
+
+/*! Remove a channel from the hop table.
+ *
+ * The last channel is never removed, the reader needs one.
+ *
+ * \param freq the channel in kHz.
+ * \return TRUE the new table is in place, FALSE the channel is
+ * not in the table or it is the last one.
+ */
+uint8_t rfid_hop_drop(const uint32_t freq)
+{
+	uint8_t i;
+
+	if (rfid->hop.count < 2)
+		return(FALSE);
+
+	for (i = 0; i < rfid->hop.count; i++)
+		if (rfid->hop.freq[i] == freq) {
+			rfid->hop.count--;
+			memmove(rfid->hop.freq + i, rfid->hop.freq + i + 1,
+					(rfid->hop.count - i) << 2);
+			memmove(rfid->hop.reads + i, rfid->hop.reads + i + 1,
+					(rfid->hop.count - i) << 1);
+			return(hop_send());
+		}
+
+	return(FALSE);
+}
+
+/*! Encode the access password and the select filter.
+ *
+ * \param buf the area to write to.
+ * \param option where to store the singulation option.
+ * \return the number of bytes written.
+ */
+uint8_t access_encode(uint8_t *buf, uint8_t *option)
+{
+	uint8_t n;
+
+	buf[0] = (uint8_t)(rfid->password >> 24);
+	buf[1] = (uint8_t)(rfid->password >> 16);
+	buf[2] = (uint8_t)(rfid->password >> 8);
+	buf[3] = (uint8_t)(rfid->password & 0xff);
+	n = select_encode(buf + 4, &rfid->select);
+
+	if (n)
+		*option = rfid->select.option;
+	else
+		*option = RFID_SEL_PASSWORD;
+
+	return(n + 4);
+}
+
+void bulk_chunk(const uint8_t ok);
+
+/*! Submit the next chunk of the bulk memory command.
+ *
+ * Read (28h):
+ * > 28 [timeout(2)] [option] [bank] [address(4)] [count] [access]
+ * Write (24h):
+ * > 24 [timeout(2)] [option] [address(4)] [bank] [access] [data]
+ *
+ * The chunk is the largest number of words the frame can carry.
+ */
+void bulk_next(void)
+{
+	uint8_t *p, *option, max;
+
+	p = rfid->data;
+	*p++ = (uint8_t)(RFID_MEM_TIMEOUT >> 8);
+	*p++ = (uint8_t)(RFID_MEM_TIMEOUT & 0xff);
+	option = p++;
+
+	if (rfid->bulk.opcode == 0x28)
+		*p++ = rfid->bulk.bank;
+
+	*p++ = (uint8_t)(rfid->bulk.address >> 24);
+	*p++ = (uint8_t)(rfid->bulk.address >> 16);
+	*p++ = (uint8_t)(rfid->bulk.address >> 8);
+	*p++ = (uint8_t)(rfid->bulk.address & 0xff);
+
+	if (rfid->bulk.opcode == 0x28) {
+		/* the reply is the option byte and the data */
+		max = (RFID_BUFFER_SIZE - 1) >> 1;
+		p++;
+		p += access_encode(p, option);
+	} else {
+		*p++ = rfid->bulk.bank;
+		p += access_encode(p, option);
+		max = (RFID_BUFFER_SIZE - (p - rfid->data)) >> 1;
+	}
+
+	if (max > RFID_MEM_WORDS)
+		max = RFID_MEM_WORDS;
+
+	if (rfid->bulk.words < max)
+		rfid->bulk.chunk = rfid->bulk.words;
+	else
+		rfid->bulk.chunk = max;
+
+	if (rfid->bulk.opcode == 0x28) {
+		rfid->data[8] = rfid->bulk.chunk;
+	} else {
+		memcpy(p, rfid->bulk.buf, rfid->bulk.chunk << 1);
+		p += rfid->bulk.chunk << 1;
+	}
+
+	rfid->opcode = rfid->bulk.opcode;
+	rfid->len = p - rfid->data;
+	rfid_cmd_submit(RFID_CMD_TIMEOUT + RFID_MEM_TIMEOUT,
+			bulk_chunk);
+}
+
+/*! A chunk of the bulk memory command is over.
+ *
+ * Called at the end of every chunk, the next one is submitted
+ * from here so the serial link does not wait for the application.
+ *
+ * \param ok the chunk result.
+ */
+void bulk_chunk(const uint8_t ok)
+{
+	uint8_t size, pass;
+
+	size = rfid->bulk.chunk << 1;
+	pass = ok;
+
+	/* the reply of the read starts with the option byte */
+	if (pass && (rfid->bulk.opcode == 0x28)) {
+		if (rfid->len > size)
+			memcpy(rfid->bulk.buf, rfid->data + 1, size);
+		else
+			pass = FALSE;
+	}
+
+	if (pass) {
+		rfid->bulk.buf += size;
+		rfid->bulk.address += rfid->bulk.chunk;
+		rfid->bulk.words -= rfid->bulk.chunk;
+		rfid->bulk.done += rfid->bulk.chunk;
+	}
+
+	if (pass && rfid->bulk.words) {
+		bulk_next();
+	} else {
+		if (!pass)
+			rfid->state = RFID_CMD_FAIL;
+
+		if (rfid->bulk.callback)
+			rfid->bulk.callback(pass);
+	}
+}
+
+/*! Start a bulk memory command.
+ */
+uint8_t bulk_submit(const uint8_t opcode, const uint8_t bank,
+		const uint32_t address, const uint16_t words, uint8_t *buf,
+		void (*callback)(const uint8_t ok))
+{
+	if (rfid_cmd_busy() || !words)
+		return(FALSE);
+
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+
+	if (!rfid->data)
+		return(FALSE);
+
+	usart_clear_rx_buffer(RFID_USART);
+	rfid->bulk.opcode = opcode;
+	rfid->bulk.bank = bank;
+	rfid->bulk.address = address;
+	rfid->bulk.words = words;
+	rfid->bulk.done = 0;
+	rfid->bulk.buf = buf;
+	rfid->bulk.callback = callback;
+	bulk_next();
+	return(TRUE);
+}
+
+/*! Read a memory region of a tag without waiting.
+ *
+ * The region is split in the largest chunks allowed by the frame,
+ * the tag is singulated with the select filter and the access
+ * password.
+ * Proceed with rfid_cmd_poll() then close with rfid_mem_get().
+ *
+ * \param bank the memory bank.
+ * \param address the first word.
+ * \param words the number of words.
+ * \param buf where to copy the data, words * 2 bytes.
+ * \param callback called when all the chunks are over or one
+ * failed, can be NULL.
+ * \return TRUE the command has been submitted.
+ */
+uint8_t rfid_mem_read_submit(const uint8_t bank, const uint32_t address,
+		const uint16_t words, uint8_t *buf,
+		void (*callback)(const uint8_t ok))
+{
+	return(bulk_submit(0x28, bank, address, words, buf, callback));
+}
+
+/*! Write a memory region of a tag without waiting.
+ *
+ * \see rfid_mem_read_submit()
+ * \param buf the data to write, words * 2 bytes, it must be kept
+ * until the end.
+ */
+uint8_t rfid_mem_write_submit(const uint8_t bank, const uint32_t address,
+		const uint16_t words, const uint8_t *buf,
+		void (*callback)(const uint8_t ok))
+{
+	return(bulk_submit(0x24, bank, address, words, (uint8_t *)buf,
+				callback));
+}
+
+/*! Close the bulk memory command.
+ *
+ * Must be called once for every rfid_mem_*_submit(), it releases
+ * the buffer. In case of failure rfid->status is the error of the
+ * failed chunk.
+ *
+ * \return the number of words transferred.
+ */
+uint16_t rfid_mem_get(void)
+{
+	free(rfid->data);
+	rfid->state = RFID_CMD_IDLE;
+	return(rfid->bulk.done);
+}
+
+/*! Read a memory region of a tag.
+ *
+ * \see rfid_mem_read_submit()
+ * \return the number of words read.
+ */
+uint16_t rfid_mem_read(const uint8_t bank, const uint32_t address,
+		const uint16_t words, uint8_t *buf)
+{
+	if (!rfid_mem_read_submit(bank, address, words, buf, NULL))
+		return(0);
+
+	cmd_wait();
+	return(rfid_mem_get());
+}
+
+/*! Write a memory region of a tag.
+ *
+ * \see rfid_mem_write_submit()
+ * \return the number of words written.
+ */
+uint16_t rfid_mem_write(const uint8_t bank, const uint32_t address,
+		const uint16_t words, const uint8_t *buf)
+{
+	if (!rfid_mem_write_submit(bank, address, words, buf, NULL))
+		return(0);
+
+	cmd_wait();
+	return(rfid_mem_get());
+}
+
+void enc_step(const uint8_t ok);
+
+/*! Submit the write of the EPC of the tag in progress (23h).
+ *
+ * > 23 [timeout(2)] [option] [access] [EPC]
+ *
+ * Without password and filter the option is 00 and no access
+ * field is present.
+ */
+void enc_write(void)
+{
+	uint8_t *p;
+
+	p = rfid->data;
+	*p++ = (uint8_t)(RFID_MEM_TIMEOUT >> 8);
+	*p++ = (uint8_t)(RFID_MEM_TIMEOUT & 0xff);
+
+	if (rfid->password || rfid->select.option) {
+		p++;
+		p += access_encode(p, rfid->data + 2);
+	} else {
+		*p++ = 0;
+	}
+
+	memcpy(p, rfid->encode.epc + rfid->encode.idx * rfid->encode.epc_len,
+			rfid->encode.epc_len);
+	p += rfid->encode.epc_len;
+	rfid->opcode = 0x23;
+	rfid->len = p - rfid->data;
+	rfid->encode.step = RFID_ENC_WRITE;
+	rfid_cmd_submit(RFID_CMD_TIMEOUT + RFID_MEM_TIMEOUT,
+			enc_step);
+}
+
+/*! Submit the read back of the EPC just written (21h).
+ *
+ * > 21 [timeout(2)] [option] [filter]
+ *
+ * The select filter of the write singulates the same tag, without
+ * a filter the short form is sent. A filter on the EPC would not
+ * match the new one, select the tags by TID to encode them.
+ */
+void enc_verify(void)
+{
+	uint8_t n;
+
+	rfid->data[0] = (uint8_t)(RFID_MEM_TIMEOUT >> 8);
+	rfid->data[1] = (uint8_t)(RFID_MEM_TIMEOUT & 0xff);
+	n = select_encode(rfid->data + 3, &rfid->select);
+
+	if (n) {
+		rfid->data[2] = rfid->select.option;
+		rfid->len = n + 3;
+	} else {
+		rfid->len = 2;
+	}
+
+	rfid->opcode = 0x21;
+	rfid->encode.step = RFID_ENC_VERIFY;
+	rfid_cmd_submit(RFID_CMD_TIMEOUT + RFID_MEM_TIMEOUT,
+			enc_step);
+}
+
+/*! Start the next tag of the queue.
+ */
+void enc_next(void)
+{
+	rfid->encode.retry = RFID_ENC_RETRY;
+	rfid->encode.start = hal_millis();
+	enc_write();
+}
+
+/*! A command of the encoding pipeline is over.
+ *
+ * Called at the end of every write and verify, the next command
+ * is submitted from here so the serial link does not wait for the
+ * application.
+ *
+ * \param ok the command result.
+ */
+void enc_step(const uint8_t ok)
+{
+	uint16_t msec;
+	uint8_t pass;
+
+	pass = ok;
+
+	if (pass && (rfid->encode.step == RFID_ENC_WRITE)) {
+		enc_verify();
+		return;
+	}
+
+	/* the read back must start with the EPC written */
+	if (pass)
+		pass = (rfid->len >= rfid->encode.epc_len) &&
+			!memcmp(rfid->data, rfid->encode.epc + rfid->encode.idx *
+					rfid->encode.epc_len, rfid->encode.epc_len);
+
+	if (!pass && rfid->encode.retry) {
+		rfid->encode.retry--;
+		rfid->encode.retries++;
+		enc_write();
+		return;
+	}
+
+	msec = hal_millis() - rfid->encode.start;
+
+	if (pass)
+		rfid->encode.ok++;
+	else
+		rfid->encode.failed++;
+
+	if (rfid->encode.report)
+		rfid->encode.report(rfid->encode.idx, pass, msec);
+
+	rfid->encode.idx++;
+
+	if (rfid->encode.idx < rfid->encode.count) {
+		enc_next();
+	} else {
+		rfid->encode.msec = hal_millis() - rfid->encode.msec;
+		rfid->state = RFID_CMD_DONE;
+	}
+}
+
+/*! Encode a queue of EPCs without waiting.
+ *
+ * For every EPC: write it (23h) on the tag in the field, read it
+ * back (21h) and compare. On failure the tag is retried up to
+ * RFID_ENC_RETRY times, then it is skipped.
+ * Write and verify of the next tag follow without waiting for the
+ * application.
+ *
+ * Proceed with rfid_cmd_poll() until RFID_CMD_DONE then close with
+ * rfid_encode_get(), the statistics are in rfid->encode.
+ *
+ * \param epc the EPCs, one after the other, kept until the end.
+ * \param epc_len the size of every EPC in byte.
+ * \param count the number of EPCs.
+ * \param report called for every tag with its index, the result
+ * and the time in msec, can be NULL.
+ * \return TRUE the pipeline has been started.
+ */
+uint8_t rfid_encode_submit(const uint8_t *epc, const uint8_t epc_len,
+		const uint8_t count, void (*report)(const uint8_t idx,
+			const uint8_t ok, const uint16_t msec))
+{
+	if (rfid_cmd_busy() || !count || !epc_len)
+		return(FALSE);
+
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+
+	if (!rfid->data)
+		return(FALSE);
+
+	usart_clear_rx_buffer(RFID_USART);
+	rfid->encode.epc = epc;
+	rfid->encode.epc_len = epc_len;
+	rfid->encode.count = count;
+	rfid->encode.report = report;
+	rfid->encode.idx = 0;
+	rfid->encode.ok = 0;
+	rfid->encode.failed = 0;
+	rfid->encode.retries = 0;
+	rfid->encode.msec = hal_millis();
+	enc_next();
+	return(TRUE);
+}
+
+/*! Close the encoding pipeline.
+ *
+ * Must be called once for every rfid_encode_submit(), it releases
+ * the buffer.
+ *
+ * \return the number of tags encoded.
+ */
+uint8_t rfid_encode_get(void)
+{
+	free(rfid->data);
+	rfid->state = RFID_CMD_IDLE;
+	return(rfid->encode.ok);
+}
+
+/*! Encode a queue of EPCs.
+ *
+ * \see rfid_encode_submit()
+ * \return the number of tags encoded.
+ */
+uint8_t rfid_encode(const uint8_t *epc, const uint8_t epc_len,
+		const uint8_t count, void (*report)(const uint8_t idx,
+			const uint8_t ok, const uint16_t msec))
+{
+	if (!rfid_encode_submit(epc, epc_len, count, report))
+		return(0);
+
+	cmd_wait();
+	return(rfid_encode_get());
+}
+
+/*! Encoding rate of the last pipeline.
+ *
+ * \return tags encoded per second, in hundredths (250 = 2.5/s).
+ */
+uint16_t rfid_encode_rate(void)
+{
+	uint32_t rate;
+
+	if (!rfid->encode.msec)
+		return(0);
+
+	rate = (uint32_t)rfid->encode.ok * 100000UL / rfid->encode.msec;
+	return(rate > 0xffff ? 0xffff : (uint16_t)rate);
+}
+
+/*! Failure rate of the last pipeline.
+ *
+ * Every retry follows a failed attempt, every skipped tag ends
+ * with one.
+ *
+ * \return percent of the write and verify attempts failed.
+ */
+uint8_t rfid_encode_fail_rate(void)
+{
+	uint32_t fail, attempts;
+
+	fail = (uint32_t)rfid->encode.retries + rfid->encode.failed;
+	attempts = fail + rfid->encode.ok;
+
+	if (!attempts)
+		return(0);
+
+	return((uint8_t)(fail * 100UL / attempts));
+}
+
+/*! Suspend call.
+ *
+ * \ingroup sleep_group
+ */
+void rfid_suspend(void)
+{
+	usart_suspend(RFID_USART_PORT);
+}
+
+/*! Check the region of a running firmware against the cache.
+ *
+ * Get Current Region (67h):
+ * -> ff00671d68
+ * <- ff0167000002b483 (EU)
+ *
+ * \return TRUE the firmware has the cached region.
+ */
+static uint8_t region_check(void)
+{
+	uint8_t region;
+
+	region = rfid->hop.region ? rfid->hop.region :
+		pgm_read_byte(m5_region + 3);
+
+	return(send_cmd_P(m5_region_get) && (rfid->len == 1) &&
+			(rfid->data[0] == region));
+}
+
+/*! Resume call.
+ *
+ * Only the settings not already applied to the running firmware
+ * are sent, see rfid_cfg_clear().
+ * A firmware found already running is trusted to hold the cache
+ * only if its region is the cached one, a module restarted and
+ * set to the same region by someone else is not detected.
+ *
+ * \ingroup sleep_group
+ */
+uint8_t rfid_resume(void)
+{
+	rfid->data = malloc(0xff);
+	usart_resume(RFID_USART_PORT);
+	hal_delay_ms(100);
+
+	/* Boot Firmware (04h):
+	 * ff00041d0b
+	 *
+	 * The maximum time required to boot the application firmware is 650ms.
+	 */
+	if (send_cmd_P(m5_boot)) {
+		/* Fresh firmware, it starts with the default settings */
+		rfid_cfg_clear();
+	} else if (!rfid->error && (rfid->status == 0x0101)) {
+		/* The firmware is already started, it kept the settings
+		 * applied in the previous run if it still has the region.
+		 */
+		if (rfid->cfg[RFID_CFG_REGION] && !region_check())
+			rfid_cfg_clear();
+	}
+
+	/* Set Current Region (97h), the one of rfid_region() with its
+	 * hop table and time.
+	 * EU: ff0197024bbf
+	 * EU3: ff0197084bb5
+	 */
+	if (!rfid->error)
+		hop_apply();
+
+	/* Set Current Tag Protocol (93h) [to Gen2]
+	 * ff02930005517d
+	 */
+	if (!rfid->error)
+		cfg_apply_P(RFID_CFG_PROTOCOL, m5_protocol);
+
+	/* Gen2 configuration of rfid_gen2() (9Bh) */
+	if (!rfid->error)
+		gen2_apply();
+
+	/* Set power mode (to min, it is off, but the tx still the same)
+	 * also it consume a lot less.
+	 * -> ff01980344be
+	 * <- ff009800008671
+	 */
+	if (!rfid->error)
+		cfg_apply_P(RFID_CFG_POWER, m5_power);
+
+	/* The power set with rfid_power() if any */
+	if (!rfid->error && rfid->power.cdbm)
+		power_apply(rfid->power.cdbm);
+
+#ifdef RFID_M5_LOWTXPWR
+	/* set the tx (read) power to the minimum (03e8 from above)
+	 * -> ff029203e842b1
+	 * <- ff00920000273b
+	 */
+	if (!rfid->error && !rfid->power.cdbm)
+		cfg_apply_P(RFID_CFG_TXPWR, m5_txpwr);
+#endif
+
+	/* Set the Reader config (max epc lenght) to 496 bits
+	 * > 9a 01 02 01
+	 * -> ff039a010201ad5c
+	 * <- ff009a0000a633
+	 */
+	if (!rfid->error)
+		cfg_apply_P(RFID_CFG_CONFIG, m5_config);
+
+	free(rfid->data);
+	return(rfid->error);
+}
+
+/*! Initialize the msec clock, the USART port and the rfid struct.
+ */
+struct rfid_t* rfid_init(void)
+{
+	hal_init();
+	rfid = malloc(sizeof(struct rfid_t));
+	rfid->usart = usart_init(RFID_USART_PORT);
+	rfid->size = RFID_SIZE;
+	rfid->state = RFID_CMD_IDLE;
+	rfid->callback = NULL;
+	rfid->frame = NULL;
+	rfid->meta = 0;
+
+	profile_default();
+	rfid->embed.count = 0;
+	rfid->antenna = 0;
+	rfid_antenna_reset();
+	memset(&rfid->power, 0, sizeof(struct rfid_power_t));
+	memset(&rfid->gen2, RFID_GEN2_DEFAULT, sizeof(struct rfid_gen2_t));
+	rfid->gen2.tune = FALSE;
+	rfid->gen2.pop = 0;
+	rfid_round_ctl(RFID_ROUND_BASE, RFID_ROUND_BASE, RFID_ROUND_BASE);
+	rfid->hop.region = 0;
+	rfid->hop.count = 0;
+	rfid->hop.time = 0;
+
+#ifdef RFID_M5_CFG_EEPROM
+	eeprom_read_block(rfid->cfg, ee_cfg, sizeof(ee_cfg));
+#else
+	memset(rfid->cfg, 0, sizeof(rfid->cfg));
+#endif
+
+#ifdef RFID_M5_HIST
+	rfid_hist_clear();
+#endif
+
+#ifdef RFID_M5_LOG
+	rfid_log_clear();
+#endif
+
 	/* data should be allocated on a usage needs */
 	/* rfid->data = malloc(0xff); */
 	return(rfid);
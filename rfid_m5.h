@@ -69,25 +69,580 @@
  * 17dBm = 50mW
  * 17.78dBm = 60mW (0x06f2)
  * 23dBm = 199.5mW (0x08fc)
+ *
+ * At runtime see rfid_power() and rfid_power_cdbm().
  */
 #ifdef RFID_M5_LOWTXPWR
 #define RFID_M5_TX_RDBM_H 0x06
 #define RFID_M5_TX_RDBM_L 0xf2
 #endif
 
+/*! The read power in centi-dBm of a constant dBm, RFID_DBM(17.78) */
+#define RFID_DBM(dbm) ((uint16_t)((dbm) * 100 + 0.5))
+
+/*! RSSI not known */
+#define RFID_RSSI_NONE -128
+
+/*! Keep a copy of the applied reader configuration in EEPROM.
+ *
+ * -D RFID_M5_CFG_EEPROM
+ *
+ * Without it the configuration is cached in RAM only and
+ * the first rfid_resume() after a reset sends everything.
+ */
+
+/*! Settings cached by rfid_resume().
+ *
+ * Index of rfid->cfg[], every slot holds the CRC of the frame last
+ * applied, 0 if unknown.
+ */
+#define RFID_CFG_REGION 0
+#define RFID_CFG_PROTOCOL 1
+#define RFID_CFG_POWER 2
+#define RFID_CFG_TXPWR 3
+#define RFID_CFG_CONFIG 4
+#define RFID_CFG_SESSION 5
+#define RFID_CFG_TARGET 6
+#define RFID_CFG_Q 7
+#define RFID_CFG_ENCODING 8
+#define RFID_CFG_BLF 9
+#define RFID_CFG_TARI 10
+#define RFID_CFG_HOPTABLE 11
+#define RFID_CFG_HOPTIME 12
+#define RFID_CFG_SIZE 13
+
+/*! Latency histograms of the commands, per opcode.
+ *
+ * -D RFID_M5_HIST
+ *
+ * Every command is timed in phases with hal_micros(): the TX of
+ * the frame to the usart, the reader think time up to the SOH of
+ * the reply, the RX of the reply and its CRC check.
+ * The bytes are seen when rfid_cmd_poll() runs, the think and RX
+ * times include the poll period of the caller.
+ *
+ * Bucket 0 counts the phases under 16 usec, bucket n the ones in
+ * [2^(n + 3), 2^(n + 4)) usec, the last one the ones over 262 msec.
+ * The first RFID_HIST_SIZE opcodes sent get a slot, the others are
+ * not counted.
+ *
+ * \see rfid_hist_dump()
+ */
+#define RFID_HIST_TX 0
+#define RFID_HIST_THINK 1
+#define RFID_HIST_RX 2
+#define RFID_HIST_CRC 3
+#define RFID_HIST_PHASES 4
+#define RFID_HIST_BUCKETS 16
+#define RFID_HIST_SHIFT 4
+
+#ifndef RFID_HIST_SIZE
+#define RFID_HIST_SIZE 12
+#endif
+
+/*! Binary log of the frames on the wire.
+ *
+ * -D RFID_M5_LOG
+ *
+ * Every frame sent and received is recorded in a RAM ring of
+ * RFID_LOG_SIZE bytes, the oldest records are dropped to make room.
+ * A record is:
+ *
+ * [flags] [msec(2)] [frame]
+ *
+ * flags RFID_LOG_*, msec the low 16 bits of hal_millis(), frame the
+ * bytes after the SOH:
+ * TX: [len] [opcode] [data] [crc(2)]
+ * RX: [len] [opcode] [status(2)] [data] [crc(2)]
+ * A timeout has no frame. The 16 bits fields are MSB first.
+ *
+ * \see rfid_log_dump(), tools/m5e_log.c
+ */
+#define RFID_LOG_RX 0x01
+#define RFID_LOG_BADCRC 0x02
+#define RFID_LOG_TIMEOUT 0x04
+/*! Version of the dump */
+#define RFID_LOG_VERSION 1
+
+#ifndef RFID_LOG_SIZE
+#define RFID_LOG_SIZE 512
+#endif
+
 /*! Tag singulation field
  *
  *  Fix for your needs.
  *
- * \note make it changable during runtime.
+ * \note it is only the default, see rfid_select().
  */
 #define RFID_M5_SINGULATION 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 
+/*! Max size of the read command data.
+ *
+ * -D RFID_PROFILE_SIZE=32
+ */
+#ifndef RFID_PROFILE_SIZE
+#define RFID_PROFILE_SIZE 32
+#endif
+
+/*! Where the select filter starts in the read memory command */
+#define RFID_PROFILE_SEL 13
+
+/*! Max size of the select mask.
+ *
+ * -D RFID_SELECT_SIZE=12
+ */
+#ifndef RFID_SELECT_SIZE
+#define RFID_SELECT_SIZE 12
+#endif
+
+#if (RFID_PROFILE_SEL + 5 + RFID_SELECT_SIZE) > RFID_PROFILE_SIZE
+#error RFID_SELECT_SIZE does not fit in RFID_PROFILE_SIZE
+#endif
+
+/*! Gen2 select (singulation) options */
+#define RFID_SEL_NONE 0x00
+/*! match the mask on the EPC */
+#define RFID_SEL_EPC 0x01
+/*! match the mask on the TID at the given bit address */
+#define RFID_SEL_TID 0x02
+/*! match the mask on the user memory at the given bit address */
+#define RFID_SEL_USER 0x03
+/*! no select, only the access password */
+#define RFID_SEL_PASSWORD 0x05
+/*! select the tags which do NOT match */
+#define RFID_SEL_INVERT 0x08
+/*! the metadata flags are present, EPC read only */
+#define RFID_SEL_META 0x10
+
+/*! Max EPC and memory data kept for every tag.
+ *
+ * -D RFID_EPC_SIZE=16
+ * -D RFID_DATA_SIZE=8
+ */
+#ifndef RFID_EPC_SIZE
+#define RFID_EPC_SIZE RFID_SIZE
+#endif
+
+#ifndef RFID_DATA_SIZE
+#define RFID_DATA_SIZE 8
+#endif
+
+/*! Max words in a chunk of the bulk memory commands.
+ *
+ * The frame allows up to 127 words, reduce it if the tags
+ * do not accept long commands.
+ * -D RFID_MEM_WORDS=32
+ */
+#ifndef RFID_MEM_WORDS
+#define RFID_MEM_WORDS 127
+#endif
+
+/*! Tag timeout of every chunk in msec */
+#ifndef RFID_MEM_TIMEOUT
+#define RFID_MEM_TIMEOUT 500
+#endif
+
+/*! Attempts on every tag of the encoding pipeline after the 1st */
+#ifndef RFID_ENC_RETRY
+#define RFID_ENC_RETRY 2
+#endif
+
+/*! Max antennas of the scheduler.
+ *
+ * -D RFID_ANT_SIZE=4
+ */
+#ifndef RFID_ANT_SIZE
+#define RFID_ANT_SIZE 4
+#endif
+
+/*! Bounds of the adaptive antenna dwell in msec */
+#ifndef RFID_ANT_DWELL_MIN
+#define RFID_ANT_DWELL_MIN 50
+#endif
+
+#ifndef RFID_ANT_DWELL_MAX
+#define RFID_ANT_DWELL_MAX 2000
+#endif
+
+/*! Duration of rfid_round() in msec until rfid_round_ctl() */
+#ifndef RFID_ROUND_BASE
+#define RFID_ROUND_BASE 500
+#endif
+
+/*! Regions of rfid_region() */
+#define RFID_REGION_NA 0x01
+#define RFID_REGION_EU 0x02
+#define RFID_REGION_KR 0x03
+#define RFID_REGION_IN 0x04
+#define RFID_REGION_JP 0x05
+#define RFID_REGION_PRC 0x06
+#define RFID_REGION_EU2 0x07
+#define RFID_REGION_EU3 0x08
+#define RFID_REGION_OPEN 0xff
+
+/*! Max channels of the hop table.
+ *
+ * -D RFID_HOP_SIZE=16
+ */
+#ifndef RFID_HOP_SIZE
+#define RFID_HOP_SIZE 16
+#endif
+
+/*! Encoding pipeline steps */
+#define RFID_ENC_WRITE 0
+#define RFID_ENC_VERIFY 1
+
+/*! Gen2 configuration values.
+ *
+ * \see struct rfid_gen2_t
+ */
+#define RFID_GEN2_DEFAULT 0xff
+#define RFID_GEN2_S0 0
+#define RFID_GEN2_S1 1
+#define RFID_GEN2_S2 2
+#define RFID_GEN2_S3 3
+#define RFID_GEN2_A 0
+#define RFID_GEN2_B 1
+/*! search A then flip to B */
+#define RFID_GEN2_AB 2
+#define RFID_GEN2_BA 3
+/*! Q chosen by the firmware, or 0 - 15 static */
+#define RFID_GEN2_Q_DYNAMIC 0xfe
+/*! tag encoding FM0, Miller M = 2, 4, 8 */
+#define RFID_GEN2_FM0 0
+#define RFID_GEN2_M2 1
+#define RFID_GEN2_M4 2
+#define RFID_GEN2_M8 3
+/*! backscatter link frequency */
+#define RFID_GEN2_BLF_250 0
+#define RFID_GEN2_BLF_640 4
+/*! Tari 25, 12.5, 6.25 usec */
+#define RFID_GEN2_TARI_25 0
+#define RFID_GEN2_TARI_12 1
+#define RFID_GEN2_TARI_6 2
+
+/*! Tag buffer metadata flags */
+#define RFID_META_COUNT 0x0001
+#define RFID_META_RSSI 0x0002
+#define RFID_META_ANTENNA 0x0004
+#define RFID_META_FREQ 0x0008
+#define RFID_META_TIME 0x0010
+#define RFID_META_PHASE 0x0020
+#define RFID_META_PROTOCOL 0x0040
+/*! data read by the embedded command */
+#define RFID_META_DATA 0x0080
+#define RFID_META_GPIO 0x0100
+
 #ifndef TRUE
 #define TRUE 1
 #define FALSE 0
 #endif
 
+/*! Compile time frame encoder.
+ *
+ * Expand to the full frame SOH, len, opcode, data, CRC(Hi + Lo) with
+ * the same CRC of CRC_calcCrc8() evaluated by the compiler, to be
+ * used in constant (PROGMEM) initializers.
+ *
+ * M5_CRC_T(h) is the CCITT (0x1021) reduction of the byte h shifted
+ * out of the crc register.
+ *
+ * \note every step expands its argument many times, the encoder is
+ * limited to 3 data bytes.
+ */
+#define M5_CRC_X(h) (((h) ^ ((h) >> 4)) & 0xffU)
+#define M5_CRC_T(h) ((uint16_t)((M5_CRC_X(h) << 12) ^ (M5_CRC_X(h) << 5) ^ M5_CRC_X(h)))
+#define M5_CRC_STEP(r, d) ((uint16_t)(((uint16_t)(r) << 8) | (d)) ^ M5_CRC_T((uint16_t)(r) >> 8))
+#define M5_CRC_1(a) M5_CRC_STEP(0xffffU, (a))
+#define M5_CRC_2(a, b) M5_CRC_STEP(M5_CRC_1(a), (b))
+#define M5_CRC_3(a, b, c) M5_CRC_STEP(M5_CRC_2(a, b), (c))
+#define M5_CRC_4(a, b, c, d) M5_CRC_STEP(M5_CRC_3(a, b, c), (d))
+#define M5_CRC_5(a, b, c, d, e) M5_CRC_STEP(M5_CRC_4(a, b, c, d), (e))
+#define M5_CRC_HI(crc) ((uint8_t)((crc) >> 8))
+#define M5_CRC_LO(crc) ((uint8_t)((crc) & 0xff))
+
+#define M5_FRAME_0(op) 0xff, 0x00, (op), \
+	M5_CRC_HI(M5_CRC_2(0x00, op)), \
+	M5_CRC_LO(M5_CRC_2(0x00, op))
+#define M5_FRAME_1(op, a) 0xff, 0x01, (op), (a), \
+	M5_CRC_HI(M5_CRC_3(0x01, op, a)), \
+	M5_CRC_LO(M5_CRC_3(0x01, op, a))
+#define M5_FRAME_2(op, a, b) 0xff, 0x02, (op), (a), (b), \
+	M5_CRC_HI(M5_CRC_4(0x02, op, a, b)), \
+	M5_CRC_LO(M5_CRC_4(0x02, op, a, b))
+#define M5_FRAME_3(op, a, b, c) 0xff, 0x03, (op), (a), (b), (c), \
+	M5_CRC_HI(M5_CRC_5(0x03, op, a, b, c)), \
+	M5_CRC_LO(M5_CRC_5(0x03, op, a, b, c))
+
+/*! Async command states.
+ *
+ * \see rfid_cmd_submit()
+ * \see rfid_cmd_poll()
+ */
+#define RFID_CMD_IDLE 0
+/*! the frame is being transmitted */
+#define RFID_CMD_TX 1
+/*! waiting for the reply */
+#define RFID_CMD_RX 2
+/*! reply received and valid */
+#define RFID_CMD_DONE 3
+/*! timeout, bad reply or error status */
+#define RFID_CMD_FAIL 4
+
+/*! The blocking functions poll every RFID_POLL_MSEC */
+#define RFID_POLL_MSEC 10
+
+/*! Default timeout of a command in msec. */
+#define RFID_CMD_TIMEOUT 5000
+
+/*! Gen2 select filter */
+struct rfid_select_t {
+	/*! RFID_SEL_* optionally with RFID_SEL_INVERT */
+	uint8_t option;
+	/*! bit address, not used with RFID_SEL_EPC */
+	uint32_t address;
+	/*! mask length in bit */
+	uint8_t bits;
+	uint8_t mask[RFID_SELECT_SIZE];
+};
+
+/*! The read command used by rfid_read()
+ *
+ * Encoded once, changes are patched in place together with its CRC.
+ */
+struct rfid_profile_t {
+	/*! 0x21 read the EPC, 0x28 read the tag memory */
+	uint8_t opcode;
+	uint8_t len;
+	uint8_t data[RFID_PROFILE_SIZE];
+	/*! CRC of len, opcode and data */
+	uint16_t crc;
+};
+
+/*! Tag memory read during the inventory */
+struct rfid_embed_t {
+	uint8_t bank;
+	/*! first word */
+	uint32_t address;
+	/*! number of words, 0 disabled */
+	uint8_t count;
+};
+
+/*! A tag and its metadata
+ *
+ * The metadata not requested are 0.
+ */
+struct rfid_tag_t {
+	uint8_t epc_len;
+	uint8_t epc[RFID_EPC_SIZE];
+	/*! protocol control word */
+	uint16_t pc;
+	/*! dBm */
+	int8_t rssi;
+	uint8_t antenna;
+	/*! kHz */
+	uint32_t freq;
+	/*! times the tag has been read */
+	uint8_t count;
+	/*! msec from the start of the inventory */
+	uint32_t time;
+	/*! memory read with rfid_embed() */
+	uint16_t data_len;
+	uint8_t data[RFID_DATA_SIZE];
+} __attribute__((packed));
+
+/*! A tag and its metadata inside the reply
+ *
+ * EPC and data point to the reply, no copy.
+ */
+struct rfid_view_t {
+	const uint8_t *epc;
+	uint8_t epc_len;
+	uint16_t pc;
+	int8_t rssi;
+	uint8_t antenna;
+	uint32_t freq;
+	uint8_t count;
+	uint32_t time;
+	const uint8_t *data;
+	uint16_t data_len;
+};
+
+/*! Iterator over the records of the tag buffer reply */
+struct rfid_iter_t {
+	/*! next record */
+	const uint8_t *p;
+	const uint8_t *end;
+	/*! metadata flags of the reply */
+	uint16_t flags;
+	/*! records left */
+	uint8_t left;
+};
+
+/*! Bulk memory command in progress */
+struct rfid_bulk_t {
+	/*! 0x28 read or 0x24 write */
+	uint8_t opcode;
+	uint8_t bank;
+	/*! next word */
+	uint32_t address;
+	/*! words left */
+	uint16_t words;
+	/*! words transferred */
+	uint16_t done;
+	/*! words of the chunk in progress */
+	uint8_t chunk;
+	/*! data of the next chunk */
+	uint8_t *buf;
+	/*! called at the end, can be NULL */
+	void (*callback)(const uint8_t ok);
+};
+
+/*! Encoding pipeline */
+struct rfid_encode_t {
+	/*! queue of EPCs */
+	const uint8_t *epc;
+	uint8_t epc_len;
+	uint8_t count;
+	/*! tag in progress */
+	uint8_t idx;
+	/*! RFID_ENC_WRITE or RFID_ENC_VERIFY */
+	uint8_t step;
+	/*! attempts left on the tag */
+	uint8_t retry;
+	/*! hal_millis() when the tag started */
+	uint32_t start;
+	/*! tags encoded */
+	uint8_t ok;
+	/*! tags skipped */
+	uint8_t failed;
+	/*! attempts repeated */
+	uint16_t retries;
+	/*! msec of the whole queue */
+	uint32_t msec;
+	/*! per tag report, can be NULL */
+	void (*report)(const uint8_t idx, const uint8_t ok,
+			const uint16_t msec);
+};
+
+/*! An antenna of the scheduler */
+struct rfid_ant_t {
+	uint8_t port;
+	/*! share of the rounds */
+	uint8_t weight;
+	/*! smooth round robin credit */
+	int16_t credit;
+	/*! inventory time in msec, adaptive */
+	uint16_t dwell;
+	/*! tags found in the last round */
+	uint8_t last;
+	uint16_t rounds;
+	/*! tags found in all the rounds */
+	uint32_t tags;
+};
+
+/*! Antenna scheduler */
+struct rfid_sched_t {
+	struct rfid_ant_t ant[RFID_ANT_SIZE];
+	uint8_t count;
+	/*! antenna of the current round */
+	uint8_t idx;
+	/*! called at the end of the round, can be NULL */
+	void (*callback)(const uint8_t ok);
+};
+
+/*! Read power control, powers in centi-dBm */
+struct rfid_power_t {
+	/*! set with rfid_power(), 0 the module's one */
+	uint16_t cdbm;
+	uint16_t min;
+	uint16_t max;
+	uint16_t step;
+	/*! set-point, tags in a round */
+	uint8_t tags;
+	/*! set-point, highest RSSI in dBm */
+	int8_t rssi;
+	/*! TRUE enabled by rfid_power_ctl() */
+	uint8_t ctl;
+};
+
+/*! Gen2 protocol configuration
+ *
+ * Every field can be RFID_GEN2_DEFAULT to keep the firmware's one.
+ */
+struct rfid_gen2_t {
+	/*! RFID_GEN2_S* */
+	uint8_t session;
+	/*! RFID_GEN2_A, B, AB, BA */
+	uint8_t target;
+	/*! static Q or RFID_GEN2_Q_DYNAMIC */
+	uint8_t q;
+	/*! RFID_GEN2_FM0, M* */
+	uint8_t encoding;
+	/*! RFID_GEN2_BLF_* */
+	uint8_t blf;
+	/*! RFID_GEN2_TARI_* */
+	uint8_t tari;
+	/*! static Q tuned by rfid_gen2_tune() */
+	uint8_t tune;
+	/*! tags per round average x16, set the initial guess */
+	uint16_t pop;
+};
+
+/*! Adaptive inventory duration, times in msec */
+struct rfid_round_t {
+	uint16_t base;
+	uint16_t min;
+	uint16_t max;
+	/*! of the next round */
+	uint16_t duration;
+	/*! tags found in the last round */
+	uint8_t count;
+	/*! time of the last tag found in the last round */
+	uint16_t last;
+	uint16_t rounds;
+	/*! time of all the rounds */
+	uint32_t time;
+	/*! tags of all the rounds */
+	uint32_t tags;
+};
+
+/*! Region and frequency hopping */
+struct rfid_hop_t {
+	/*! RFID_REGION_*, 0 the default one */
+	uint8_t region;
+	/*! channels in kHz, 0 the region's table */
+	uint8_t count;
+	uint32_t freq[RFID_HOP_SIZE];
+	/*! tags read on every channel */
+	uint16_t reads[RFID_HOP_SIZE];
+	/*! msec on a channel, 0 the region's one */
+	uint32_t time;
+};
+
+/*! Latency histogram of an opcode */
+struct rfid_hist_t {
+	/*! 0 free slot */
+	uint8_t opcode;
+	/*! commands failed or timed out */
+	uint16_t fail;
+	/*! commands per phase and bucket, they stop at 0xffff */
+	uint16_t count[RFID_HIST_PHASES][RFID_HIST_BUCKETS];
+};
+
+/*! Ring of the frame log */
+struct rfid_log_t {
+	/*! next byte to write */
+	uint16_t head;
+	/*! first byte of the oldest record */
+	uint16_t tail;
+	/*! bytes in use */
+	uint16_t used;
+	/*! records dropped */
+	uint16_t lost;
+	uint8_t buf[RFID_LOG_SIZE];
+};
+
 /*! a single rfid record
  *
  * \bug the struct changes based on the RFID_M5 defs,
@@ -106,12 +661,143 @@ struct rfid_t {
 	uint16_t status;
 	uint16_t crc;
 	uint8_t error;
+	/*! async command state RFID_CMD_* */
+	uint8_t state;
+	/*! the opcode sent, the reply must match */
+	uint8_t cmd;
+	/*! byte index in the frame under tx or rx */
+	uint16_t idx;
+	/*! hal_millis() after which the command fails */
+	uint32_t deadline;
+	/*! called when the command ends, can be NULL */
+	void (*callback)(const uint8_t ok);
+	/*! constant (PROGMEM) frame to tx instead of the fields above */
+	const uint8_t *frame;
+	/*! configuration applied to the running firmware */
+	uint16_t cfg[RFID_CFG_SIZE];
+	/*! the read command */
+	struct rfid_profile_t profile;
+	/*! the select filter */
+	struct rfid_select_t select;
+	/*! the inventory embedded read */
+	struct rfid_embed_t embed;
+	/*! tag access password */
+	uint32_t password;
+	/*! bulk memory command */
+	struct rfid_bulk_t bulk;
+	/*! encoding pipeline */
+	struct rfid_encode_t encode;
+	/*! RFID_META_* returned with the tags */
+	uint16_t meta;
+	/*! antenna port in use, 0 unknown */
+	uint8_t antenna;
+	/*! antenna scheduler */
+	struct rfid_sched_t sched;
+	/*! read power control */
+	struct rfid_power_t power;
+	/*! Gen2 configuration */
+	struct rfid_gen2_t gen2;
+	/*! adaptive inventory duration */
+	struct rfid_round_t round;
+	/*! region and frequency hopping */
+	struct rfid_hop_t hop;
+#ifdef RFID_M5_HIST
+	/*! usec at the start of every phase and at the end */
+	uint32_t stamp[RFID_HIST_PHASES + 1];
+	struct rfid_hist_t hist[RFID_HIST_SIZE];
+#endif
+#ifdef RFID_M5_LOG
+	/*! frames on the wire */
+	struct rfid_log_t log;
+#endif
 };
 
 /*! Globals */
-struct rfid_t *rfid;
+extern struct rfid_t *rfid;
 
+uint8_t rfid_cmd_submit(const uint32_t timeout, void (*callback)(const uint8_t ok));
+uint8_t rfid_cmd_submit_P(const uint8_t *frame, const uint32_t timeout,
+		void (*callback)(const uint8_t ok));
+uint8_t rfid_cmd_busy(void);
+uint8_t rfid_cmd_poll(void);
+void rfid_cmd_cancel(void);
+void rfid_profile_epc(const uint16_t timeout);
+void rfid_profile_data(const uint16_t timeout, const uint8_t bank,
+		const uint32_t address, const uint8_t count);
+void rfid_profile_timeout(const uint16_t timeout);
+void rfid_password(const uint32_t password);
+uint8_t rfid_select(const struct rfid_select_t *sel);
+void rfid_metadata(const uint16_t flags);
+uint8_t rfid_read_submit(void);
+uint8_t rfid_read_tag_get(struct rfid_tag_t *tag);
+uint8_t rfid_read_get(uint8_t *data);
 uint8_t rfid_read(uint8_t *data);
+uint8_t rfid_read_tag(struct rfid_tag_t *tag);
+void rfid_embed(const uint8_t bank, const uint32_t address,
+		const uint8_t count);
+uint8_t rfid_inventory_submit(const uint16_t timeout);
+uint8_t rfid_inventory_get(void);
+uint8_t rfid_inventory(const uint16_t timeout);
+uint8_t rfid_antenna(const uint8_t port);
+void rfid_antenna_reset(void);
+uint8_t rfid_antenna_add(const uint8_t port, const uint16_t dwell,
+		const uint8_t weight);
+uint8_t rfid_antenna_submit(void (*callback)(const uint8_t ok));
+uint8_t rfid_antenna_round(void);
+uint16_t rfid_power_cdbm(const uint16_t mw);
+uint8_t rfid_power(const uint16_t cdbm);
+uint8_t rfid_power_ctl(const uint16_t min, const uint16_t max,
+		const uint16_t step, const uint8_t tags, const int8_t rssi);
+uint16_t rfid_power_update(const uint8_t count, const int8_t rssi);
+uint8_t rfid_gen2(const struct rfid_gen2_t *gen2);
+uint8_t rfid_gen2_tune(const uint8_t count);
+void rfid_round_ctl(const uint16_t base, const uint16_t min,
+		const uint16_t max);
+uint16_t rfid_round_update(const uint8_t count, const uint16_t last);
+int32_t rfid_round_saved(void);
+uint8_t rfid_round(struct rfid_tag_t *tags, const uint8_t size);
+uint8_t rfid_region(const uint8_t region);
+uint8_t rfid_hop_table(const uint32_t *freq, const uint8_t count);
+uint8_t rfid_hop_time(const uint32_t msec);
+void rfid_hop_count(const struct rfid_view_t *view);
+uint8_t rfid_hop_drop(const uint32_t freq);
+uint8_t rfid_tagbuf_submit(void);
+uint8_t rfid_tagbuf_first(struct rfid_iter_t *iter);
+uint8_t rfid_tagbuf_next(struct rfid_iter_t *iter, struct rfid_view_t *view);
+void rfid_tagbuf_end(void);
+uint8_t rfid_tagbuf_get(struct rfid_tag_t *tags, const uint8_t size);
+uint8_t rfid_tagbuf(struct rfid_tag_t *tags, const uint8_t size);
+uint8_t rfid_tagbuf_clear(void);
+uint8_t rfid_mem_read_submit(const uint8_t bank, const uint32_t address,
+		const uint16_t words, uint8_t *buf,
+		void (*callback)(const uint8_t ok));
+uint8_t rfid_mem_write_submit(const uint8_t bank, const uint32_t address,
+		const uint16_t words, const uint8_t *buf,
+		void (*callback)(const uint8_t ok));
+uint16_t rfid_mem_get(void);
+uint16_t rfid_mem_read(const uint8_t bank, const uint32_t address,
+		const uint16_t words, uint8_t *buf);
+uint16_t rfid_mem_write(const uint8_t bank, const uint32_t address,
+		const uint16_t words, const uint8_t *buf);
+uint8_t rfid_encode_submit(const uint8_t *epc, const uint8_t epc_len,
+		const uint8_t count, void (*report)(const uint8_t idx,
+			const uint8_t ok, const uint16_t msec));
+uint8_t rfid_encode_get(void);
+uint8_t rfid_encode(const uint8_t *epc, const uint8_t epc_len,
+		const uint8_t count, void (*report)(const uint8_t idx,
+			const uint8_t ok, const uint16_t msec));
+uint16_t rfid_encode_rate(void);
+uint8_t rfid_encode_fail_rate(void);
+uint8_t rfid_selftest(void);
+#ifdef RFID_M5_HIST
+void rfid_hist_clear(void);
+void rfid_hist_dump(const uint8_t port);
+#endif
+#ifdef RFID_M5_LOG
+void rfid_log_clear(void);
+void rfid_log_dump(const uint8_t port);
+#endif
+void rfid_cfg_clear(void);
 void rfid_suspend(void);
 uint8_t rfid_resume(void);
 struct rfid_t* rfid_init(void);
@@ -0,0 +1,51 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file rfid_m5_private.h
+ * \brief Internals of rfid_m5.c.
+ *
+ * Used by the driver, the benchmarks, the fuzz targets and the
+ * tools, not by the application: they can change at any time.
+ */
+
+#ifndef RFIDM5_PRIVATE_H
+#define RFIDM5_PRIVATE_H
+
+#include <stdint.h>
+#include "rfid_m5.h"
+
+/*! The rx parser steps stored in rfid->error.
+ *
+ * In case of failure it is possible to know at which step the
+ * problem occured.
+ */
+#define RX_END 0
+#define RX_SOH 1
+#define RX_LEN 2
+#define RX_CMD 3
+#define RX_STATUS 4
+#define RX_DATA 5
+#define RX_CRC 6
+
+void CRC_calcCrc8(uint16_t *crcReg, uint16_t u8Data);
+uint16_t m5_crc(const uint8_t include_status);
+uint8_t tx_byte(const uint16_t idx);
+void rx_reset(void);
+uint8_t rx_byte(const uint8_t c);
+
+#endif
@@ -0,0 +1,1075 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file m5e_emu.c
+ * \brief M5e reader emulator on a pseudo-terminal.
+ *
+ * Speaks the M5e framing on a pty, the driver built with
+ * HAL_POSIX uses the pty as the serial device:
+ *
+ * $ cc -o m5e_emu tools/m5e_emu.c
+ * $ m5e_emu -n 50 -L /tmp/m5e &
+ * $ app /tmp/m5e
+ *
+ * Implemented commands:
+ * 04 boot, 97 region, 67 get region, 93 protocol, 98 power mode,
+ * 92 read power, 9a reader config, 9b protocol config, 91 antenna,
+ * 95 hop table,
+ * 21 read tag single, 22 read tag multiple, 29 get tag buffer,
+ * 2a clear tag buffer, 28 read memory, 24 write memory,
+ * 23 write tag EPC.
+ * Others reply with status 0101h.
+ *
+ * options:
+ * -n tags in the field (default 20)
+ * -a antennas the tags are spread on (default 1)
+ * -l latency of every command in msec (default 2)
+ * -b baud rate of the replies, 0 no pacing (default 0)
+ * -T inventory time in percent of the requested one (default 100)
+ * -e error injection, percent of the replies (default 0)
+ * -E errors to inject: c bad CRC, d dropped, s error status,
+ *    t truncated (default cdst)
+ * -s random seed
+ * -L symlink to the pty
+ * -v log the frames to stderr
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+/*! Max tags in the field */
+#define EMU_TAGS 256
+/*! Bytes of every memory bank */
+#define EMU_BANK 64
+/*! EPC size in byte */
+#define EMU_EPC 12
+/*! Tags kept in the tag buffer */
+#define EMU_TAGBUF 256
+
+/*! Status codes */
+#define ST_OK 0x0000
+#define ST_INVALID 0x0101
+#define ST_PARAM 0x0105
+#define ST_NO_TAG 0x0400
+#define ST_MEM 0x0423
+#define ST_FAULT 0x7f00
+
+/*! A tag of the field */
+struct tag_t {
+	uint8_t epc_len;
+	/*! bank 0 reserved, 1 EPC (CRC, PC, EPC), 2 TID, 3 user */
+	uint8_t bank[4][EMU_BANK];
+	uint8_t antenna;
+	/*! dBm at 0dBm read power difference */
+	int8_t rssi;
+};
+
+/*! An entry of the tag buffer */
+struct entry_t {
+	struct tag_t *tag;
+	uint8_t count;
+	int8_t rssi;
+	uint8_t antenna;
+	uint32_t freq;
+	uint32_t time;
+	uint8_t data_len;
+	uint8_t data[EMU_BANK];
+};
+
+/*! The emulator state */
+struct emu_t {
+	int fd;
+	uint8_t booted;
+	uint8_t region;
+	uint16_t power;
+	uint8_t antenna;
+	uint32_t hop[64];
+	uint8_t hops;
+	uint32_t hop_idx;
+	/*! msec on a channel, 0 a new channel at every read */
+	uint32_t hop_time;
+	/*! msec of RF on since the boot */
+	uint32_t clock;
+	struct tag_t tags[EMU_TAGS];
+	uint16_t ntags;
+	uint8_t antennas;
+	struct entry_t buf[EMU_TAGBUF];
+	uint16_t nbuf;
+	/* options */
+	uint16_t latency;
+	uint32_t baud;
+	uint16_t time_pct;
+	uint8_t err_pct;
+	const char *err_kind;
+	uint8_t verbose;
+};
+
+static struct emu_t emu;
+
+/*! The M5e CRC, CCITT 0x1021 init 0xffff. */
+static uint16_t crc16(const uint8_t *p, const uint16_t size)
+{
+	uint16_t crc, i;
+	uint8_t bit;
+
+	crc = 0xffff;
+
+	for (i = 0; i < size; i++)
+		for (bit = 0x80; bit; bit >>= 1) {
+			if (crc & 0x8000)
+				crc = ((crc << 1) | !!(p[i] & bit)) ^ 0x1021;
+			else
+				crc = (crc << 1) | !!(p[i] & bit);
+		}
+
+	return(crc);
+}
+
+static void msleep(const uint32_t ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+
+	while (nanosleep(&ts, &ts))
+		;
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+	return(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+			((uint16_t)p[2] << 8) | p[3]);
+}
+
+static uint16_t be16(const uint8_t *p)
+{
+	return(((uint16_t)p[0] << 8) | p[1]);
+}
+
+static uint8_t *put16(uint8_t *p, const uint16_t v)
+{
+	*p++ = (uint8_t)(v >> 8);
+	*p++ = (uint8_t)(v & 0xff);
+	return(p);
+}
+
+static uint8_t *put32(uint8_t *p, const uint32_t v)
+{
+	p = put16(p, (uint16_t)(v >> 16));
+	return(put16(p, (uint16_t)(v & 0xffff)));
+}
+
+static void log_frame(const char *dir, const uint8_t *p, const uint16_t size)
+{
+	uint16_t i;
+
+	if (!emu.verbose)
+		return;
+
+	fprintf(stderr, "%s ", dir);
+
+	for (i = 0; i < size; i++)
+		fprintf(stderr, "%02x", p[i]);
+
+	fputc('\n', stderr);
+}
+
+/*! Send a reply, with the error injection and the baud pacing.
+ *
+ * < ff [len] [opcode] [status(2)] [data] [crc(2)]
+ */
+static void reply(const uint8_t opcode, uint16_t status,
+		const uint8_t *data, uint8_t len)
+{
+	uint8_t frame[262];
+	uint16_t crc, size;
+	char kind;
+
+	kind = 0;
+
+	if (emu.err_pct && ((uint8_t)(rand() % 100) < emu.err_pct))
+		kind = emu.err_kind[rand() % strlen(emu.err_kind)];
+
+	if (kind == 'd') {
+		log_frame("drop", NULL, 0);
+		return;
+	}
+
+	if (kind == 's') {
+		status = ST_FAULT;
+		len = 0;
+	}
+
+	frame[0] = 0xff;
+	frame[1] = len;
+	frame[2] = opcode;
+	put16(frame + 3, status);
+
+	if (len)
+		memcpy(frame + 5, data, len);
+	crc = crc16(frame + 1, len + 4);
+
+	if (kind == 'c')
+		crc ^= 0x5a5a;
+
+	put16(frame + 5 + len, crc);
+	size = len + 7;
+
+	if (kind == 't')
+		size = 1 + rand() % (size - 1);
+
+	if (emu.baud)
+		msleep((uint32_t)size * 10000UL / emu.baud);
+
+	log_frame("<", frame, size);
+
+	if (write(emu.fd, frame, size) < 0)
+		perror("write");
+}
+
+/*! The readable bits of a bank.
+ *
+ * The EPC bank is addressed from the CRC word.
+ */
+static uint16_t bank_bits(const struct tag_t *tag, const uint8_t bank)
+{
+	if (bank == 1)
+		return((4 + tag->epc_len) << 3);
+
+	return(EMU_BANK << 3);
+}
+
+static uint8_t bit_get(const uint8_t *p, const uint16_t bit)
+{
+	return(!!(p[bit >> 3] & (0x80 >> (bit & 7))));
+}
+
+/*! Match a select filter.
+ *
+ * EPC: [bits] [mask] on the EPC
+ * TID, USER: [address(4)] [bits] [mask] at a bit address
+ *
+ * \param option the select option.
+ * \param p the filter, moved after it.
+ */
+static uint8_t select_match(const struct tag_t *tag, const uint8_t option,
+		const uint8_t **p)
+{
+	const uint8_t *mem, *mask;
+	uint32_t address;
+	uint16_t i;
+	uint8_t bits, bank, match;
+
+	bank = option & 0x07;
+
+	if (!bank || (bank > 3))
+		return(TRUE);
+
+	address = 0;
+
+	if (bank != 1) {
+		address = be32(*p);
+		*p += 4;
+	}
+
+	bits = **p;
+	mask = *p + 1;
+	*p += 1 + ((bits + 7) >> 3);
+
+	if (bank == 1) {
+		mem = tag->bank[1] + 4;
+
+		if (bits > (tag->epc_len << 3))
+			return(!!(option & 0x08));
+	} else {
+		mem = tag->bank[bank];
+
+		if ((address + bits) > bank_bits(tag, bank))
+			return(!!(option & 0x08));
+	}
+
+	match = TRUE;
+
+	for (i = 0; match && (i < bits); i++)
+		if (bit_get(mem, address + i) != bit_get(mask, i))
+			match = FALSE;
+
+	if (option & 0x08)
+		match = !match;
+
+	return(match);
+}
+
+/*! Skip a select filter without a tag. */
+static void select_skip(const uint8_t option, const uint8_t **p)
+{
+	static struct tag_t dummy;
+
+	select_match(&dummy, option, p);
+}
+
+/*! RSSI of a tag at the current read power. */
+static int8_t tag_rssi(const struct tag_t *tag)
+{
+	return(tag->rssi + (int16_t)(emu.power - 3000) / 100);
+}
+
+/*! A tag replies if it is on the antenna and strong enough. */
+static uint8_t tag_visible(const struct tag_t *tag)
+{
+	if (emu.antenna && (emu.antennas > 1) && (tag->antenna != emu.antenna))
+		return(FALSE);
+
+	return(tag_rssi(tag) > -75);
+}
+
+/*! First visible tag matching the filter, NULL none. */
+static struct tag_t *tag_find(const uint8_t option, const uint8_t *filter)
+{
+	const uint8_t *p;
+	uint16_t i;
+
+	for (i = 0; i < emu.ntags; i++) {
+		p = filter;
+
+		if (tag_visible(emu.tags + i) &&
+				select_match(emu.tags + i, option, &p))
+			return(emu.tags + i);
+	}
+
+	return(NULL);
+}
+
+/*! The channel in kHz of a read.
+ *
+ * \param time msec of the read from the start of the round.
+ */
+static uint32_t channel(const uint32_t time)
+{
+	static const uint32_t eu[] = { 865700, 866300, 866900, 867500 };
+	uint32_t idx;
+
+	if (emu.hop_time)
+		idx = (emu.clock + time) / emu.hop_time;
+	else
+		idx = emu.hop_idx++;
+
+	if (emu.hops)
+		return(emu.hop[idx % emu.hops]);
+
+	return(eu[idx % 4]);
+}
+
+/*! Encode the metadata of a tag buffer entry. */
+static uint8_t *meta_put(uint8_t *p, const uint16_t flags,
+		const struct entry_t *e)
+{
+	if (flags & 0x0001)
+		*p++ = e->count;
+
+	if (flags & 0x0002)
+		*p++ = (uint8_t)e->rssi;
+
+	if (flags & 0x0004)
+		*p++ = e->antenna;
+
+	if (flags & 0x0008) {
+		*p++ = (uint8_t)(e->freq >> 16);
+		p = put16(p, (uint16_t)(e->freq & 0xffff));
+	}
+
+	if (flags & 0x0010)
+		p = put32(p, e->time);
+
+	if (flags & 0x0020)
+		p = put16(p, (uint16_t)(rand() & 0xfff));
+
+	if (flags & 0x0040)
+		*p++ = 0x05;
+
+	if (flags & 0x0080) {
+		p = put16(p, e->data_len << 3);
+		memcpy(p, e->data, e->data_len);
+		p += e->data_len;
+	}
+
+	if (flags & 0x0100)
+		*p++ = 0;
+
+	return(p);
+}
+
+/*! Size of the metadata of an entry. */
+static uint8_t meta_size(const uint16_t flags, const struct entry_t *e)
+{
+	uint8_t buf[EMU_BANK + 32];
+
+	return(meta_put(buf, flags, e) - buf);
+}
+
+/*! Read Tag Single (21h).
+ *
+ * > 21 [timeout(2)] [option] [metadata flags(2)] [filter]
+ * < [option] [metadata flags(2)] [metadata] [PC] [EPC] [CRC]
+ * or only the EPC without the metadata.
+ */
+static void cmd_read_single(const uint8_t *d, const uint8_t len)
+{
+	struct entry_t e;
+	struct tag_t *tag;
+	const uint8_t *filter;
+	uint8_t out[255], *p, option;
+	uint16_t flags, timeout;
+
+	timeout = be16(d);
+	option = (len > 2) ? d[2] : 0;
+	flags = 0;
+	filter = d + 3;
+
+	if (option & 0x10) {
+		flags = be16(d + 3);
+		filter = d + 5;
+	}
+
+	tag = tag_find(option, filter);
+
+	if (!tag) {
+		msleep(timeout * emu.time_pct / 100);
+		reply(0x21, ST_NO_TAG, NULL, 0);
+		return;
+	}
+
+	p = out;
+
+	if (option & 0x10) {
+		memset(&e, 0, sizeof(e));
+		e.tag = tag;
+		e.count = 1;
+		e.rssi = tag_rssi(tag);
+		e.antenna = emu.antenna ? emu.antenna : 1;
+		e.time = 1 + rand() % 20;
+		e.freq = channel(e.time);
+		*p++ = option;
+		p = put16(p, flags);
+		p = meta_put(p, flags & ~0x0080, &e);
+		memcpy(p, tag->bank[1] + 2, 2 + tag->epc_len);
+		p += 2 + tag->epc_len;
+		memcpy(p, tag->bank[1], 2);
+		p += 2;
+	} else {
+		memcpy(p, tag->bank[1] + 4, tag->epc_len);
+		p += tag->epc_len;
+	}
+
+	reply(0x21, ST_OK, out, p - out);
+}
+
+/*! Add a tag to the tag buffer, or count it again. */
+static void tagbuf_add(struct tag_t *tag, const uint32_t time,
+		const uint8_t bank, const uint32_t address, const uint8_t count)
+{
+	struct entry_t *e;
+	uint16_t i;
+
+	for (i = 0; i < emu.nbuf; i++)
+		if (emu.buf[i].tag == tag) {
+			if (emu.buf[i].count < 0xff)
+				emu.buf[i].count++;
+
+			return;
+		}
+
+	if (emu.nbuf == EMU_TAGBUF)
+		return;
+
+	e = emu.buf + emu.nbuf++;
+	e->tag = tag;
+	e->count = 1;
+	e->rssi = tag_rssi(tag);
+	e->antenna = emu.antenna ? emu.antenna : 1;
+	e->freq = channel(time);
+	e->time = time;
+	e->data_len = 0;
+
+	if (count && (bank < 4) && (((address + count) << 1) <= EMU_BANK)) {
+		e->data_len = count << 1;
+		memcpy(e->data, tag->bank[bank] + (address << 1), e->data_len);
+	}
+}
+
+/*! Read Tag Multiple (22h).
+ *
+ * > 22 [option] [search flags(2)] [timeout(2)] [filter] [embedded]
+ * < [option] [search flags(2)] [count]
+ *
+ * Every visible tag matching the filter is found in the round
+ * with 90% probability, at a random time of the round.
+ */
+static void cmd_read_multi(const uint8_t *d, const uint8_t len)
+{
+	const uint8_t *p, *filter;
+	uint8_t out[4], option, bank, count;
+	uint16_t flags, timeout, found, i;
+	uint32_t address;
+
+	if (len < 5) {
+		reply(0x22, ST_INVALID, NULL, 0);
+		return;
+	}
+
+	option = d[0];
+	flags = be16(d + 1);
+	timeout = be16(d + 3);
+	filter = d + 5;
+	p = filter;
+	select_skip(option, &p);
+	bank = 0;
+	address = 0;
+	count = 0;
+
+	/* 01 09 28 0000 00 [bank] [address(4)] [count] */
+	if ((flags & 0x0004) && ((p + 12) <= (d + len))) {
+		bank = p[6];
+		address = be32(p + 7);
+		count = p[11];
+	}
+
+	found = 0;
+
+	for (i = 0; i < emu.ntags; i++) {
+		p = filter;
+
+		if (tag_visible(emu.tags + i) &&
+				select_match(emu.tags + i, option, &p) &&
+				((rand() % 10) < 9)) {
+			tagbuf_add(emu.tags + i, rand() % (timeout + 1),
+					bank, address, count);
+			found++;
+		}
+	}
+
+	msleep(timeout * emu.time_pct / 100);
+	emu.clock += timeout;
+
+	if (!found) {
+		reply(0x22, ST_NO_TAG, NULL, 0);
+		return;
+	}
+
+	out[0] = option;
+	put16(out + 1, flags);
+	out[3] = (found > 0xff) ? 0xff : found;
+	reply(0x22, ST_OK, out, 4);
+}
+
+/*! Get Tag Buffer (29h).
+ *
+ * > 29 [metadata flags(2)] [read option]
+ * < [metadata flags(2)] [read option] [count] [records]
+ *
+ * The records fitting the frame are sent and removed.
+ */
+static void cmd_tagbuf(const uint8_t *d, const uint8_t len)
+{
+	struct entry_t *e;
+	uint8_t out[255], *p, n;
+	uint16_t flags, size;
+
+	flags = (len >= 2) ? be16(d) : 0;
+	p = put16(out, flags);
+	*p++ = (len > 2) ? d[2] : 0;
+	p++;
+	n = 0;
+
+	while (n < emu.nbuf) {
+		e = emu.buf + n;
+		size = meta_size(flags, e) + 2 + 4 + e->tag->epc_len;
+
+		if ((p - out + size) > 255)
+			break;
+
+		p = meta_put(p, flags, e);
+		p = put16(p, (4 + e->tag->epc_len) << 3);
+		memcpy(p, e->tag->bank[1] + 2, 2 + e->tag->epc_len);
+		p += 2 + e->tag->epc_len;
+		memcpy(p, e->tag->bank[1], 2);
+		p += 2;
+		n++;
+	}
+
+	out[3] = n;
+	emu.nbuf -= n;
+	memmove(emu.buf, emu.buf + n, emu.nbuf * sizeof(struct entry_t));
+	reply(0x29, ST_OK, out, p - out);
+}
+
+/*! Password and filter of the memory commands.
+ *
+ * Without option no password, with option 05h password only.
+ */
+static struct tag_t *access_find(const uint8_t option, const uint8_t **p)
+{
+	struct tag_t *tag;
+	uint32_t password;
+
+	if (!option)
+		return(tag_find(0, NULL));
+
+	password = be32(*p);
+	*p += 4;
+	tag = tag_find(option, *p);
+	select_skip(option, p);
+
+	if (tag && (password != be32(tag->bank[0] + 4)))
+		return(NULL);
+
+	return(tag);
+}
+
+/*! Read Tag Data (28h).
+ *
+ * > 28 [timeout(2)] [option] [bank] [address(4)] [count] [access]
+ * < [option] [data]
+ */
+static void cmd_read_mem(const uint8_t *d, const uint8_t len)
+{
+	struct tag_t *tag;
+	const uint8_t *p;
+	uint8_t out[255], bank, count;
+	uint32_t address;
+
+	if (len < 9) {
+		reply(0x28, ST_INVALID, NULL, 0);
+		return;
+	}
+
+	bank = d[3];
+	address = be32(d + 4);
+	count = d[8];
+	p = d + 9;
+	tag = access_find(d[2], &p);
+
+	if (!tag) {
+		reply(0x28, ST_NO_TAG, NULL, 0);
+		return;
+	}
+
+	if ((bank > 3) || ((((address + count) << 4)) > bank_bits(tag, bank)) ||
+			(count > 127)) {
+		reply(0x28, ST_MEM, NULL, 0);
+		return;
+	}
+
+	out[0] = d[2];
+	memcpy(out + 1, tag->bank[bank] + (address << 1), count << 1);
+	reply(0x28, ST_OK, out, 1 + (count << 1));
+}
+
+/*! Write Tag Data (24h).
+ *
+ * > 24 [timeout(2)] [option] [address(4)] [bank] [access] [data]
+ */
+static void cmd_write_mem(const uint8_t *d, const uint8_t len)
+{
+	struct tag_t *tag;
+	const uint8_t *p;
+	uint32_t address;
+	uint8_t bank, size;
+
+	if (len < 8) {
+		reply(0x24, ST_INVALID, NULL, 0);
+		return;
+	}
+
+	address = be32(d + 3);
+	bank = d[7];
+	p = d + 8;
+	tag = access_find(d[2], &p);
+
+	if (!tag) {
+		reply(0x24, ST_NO_TAG, NULL, 0);
+		return;
+	}
+
+	size = len - (p - d);
+
+	if ((bank > 3) || (((address << 1) + size) > EMU_BANK) || (size & 1)) {
+		reply(0x24, ST_MEM, NULL, 0);
+		return;
+	}
+
+	memcpy(tag->bank[bank] + (address << 1), p, size);
+	reply(0x24, ST_OK, NULL, 0);
+}
+
+/*! Write Tag EPC (23h).
+ *
+ * > 23 [timeout(2)] [option] [access] [EPC]
+ */
+static void cmd_write_epc(const uint8_t *d, const uint8_t len)
+{
+	struct tag_t *tag;
+	const uint8_t *p;
+	uint8_t size;
+
+	if (len < 3) {
+		reply(0x23, ST_INVALID, NULL, 0);
+		return;
+	}
+
+	p = d + 3;
+	tag = access_find(d[2], &p);
+	size = len - (p - d);
+
+	if (!tag) {
+		reply(0x23, ST_NO_TAG, NULL, 0);
+		return;
+	}
+
+	if (!size || (size > (EMU_BANK - 4)) || (size & 1)) {
+		reply(0x23, ST_MEM, NULL, 0);
+		return;
+	}
+
+	tag->epc_len = size;
+	memcpy(tag->bank[1] + 4, p, size);
+	/* PC: EPC length in words */
+	tag->bank[1][2] = (uint8_t)((size >> 1) << 3);
+	tag->bank[1][3] = 0;
+	put16(tag->bank[1], crc16(tag->bank[1] + 2, 2 + size) ^ 0xffff);
+	reply(0x23, ST_OK, NULL, 0);
+}
+
+/*! Set Frequency Hop Table (95h).
+ *
+ * > 95 [frequency kHz(4)] ...
+ * > 95 01 [hop time msec(4)]
+ */
+static void cmd_hop(const uint8_t *d, const uint8_t len)
+{
+	uint8_t i;
+
+	if ((len == 5) && (d[0] == 0x01)) {
+		emu.hop_time = be32(d + 1);
+	} else if (len && !(len & 3)) {
+		emu.hops = len >> 2;
+
+		for (i = 0; i < emu.hops; i++)
+			emu.hop[i] = be32(d + (i << 2));
+
+		emu.hop_idx = 0;
+	} else {
+		reply(0x95, ST_PARAM, NULL, 0);
+		return;
+	}
+
+	reply(0x95, ST_OK, NULL, 0);
+}
+
+/*! Gen2 parameter of Set Protocol Configuration (9Bh).
+ *
+ * > 9b 05 [parameter] [value]
+ *
+ * \return TRUE the parameter exists.
+ */
+static uint8_t gen2_known(const uint8_t *d, const uint8_t len)
+{
+	if ((len < 3) || (d[0] != 0x05))
+		return(FALSE);
+
+	switch (d[1]) {
+	case 0x00:
+	case 0x01:
+	case 0x02:
+	case 0x10:
+	case 0x11:
+	case 0x12:
+	case 0x13:
+		return(TRUE);
+	default:
+		return(FALSE);
+	}
+}
+
+/*! Execute a command frame. */
+static void command(const uint8_t opcode, const uint8_t *d, const uint8_t len)
+{
+	msleep(emu.latency);
+
+	if (!emu.booted && (opcode != 0x04)) {
+		/* the bootloader only knows the boot */
+		reply(opcode, ST_INVALID, NULL, 0);
+		return;
+	}
+
+	switch (opcode) {
+	case 0x04:
+		reply(opcode, emu.booted ? ST_INVALID : ST_OK, NULL, 0);
+		emu.booted = TRUE;
+		break;
+	case 0x67:
+		reply(opcode, ST_OK, &emu.region, 1);
+		break;
+	case 0x97:
+		emu.region = len ? d[0] : emu.region;
+		emu.hops = 0;
+		emu.hop_time = 0;
+		reply(opcode, ST_OK, NULL, 0);
+		break;
+	case 0x92:
+		if (len >= 2)
+			emu.power = be16(d);
+
+		reply(opcode, ST_OK, NULL, 0);
+		break;
+	case 0x91:
+		if (len >= 1)
+			emu.antenna = d[0];
+
+		reply(opcode, ST_OK, NULL, 0);
+		break;
+	case 0x95:
+		cmd_hop(d, len);
+		break;
+	case 0x9b:
+		reply(opcode, gen2_known(d, len) ? ST_OK : ST_PARAM,
+				NULL, 0);
+		break;
+	case 0x93:
+	case 0x98:
+	case 0x9a:
+		reply(opcode, ST_OK, NULL, 0);
+		break;
+	case 0x21:
+		cmd_read_single(d, len);
+		break;
+	case 0x22:
+		cmd_read_multi(d, len);
+		break;
+	case 0x29:
+		cmd_tagbuf(d, len);
+		break;
+	case 0x2a:
+		emu.nbuf = 0;
+		reply(opcode, ST_OK, NULL, 0);
+		break;
+	case 0x28:
+		cmd_read_mem(d, len);
+		break;
+	case 0x24:
+		cmd_write_mem(d, len);
+		break;
+	case 0x23:
+		cmd_write_epc(d, len);
+		break;
+	default:
+		reply(opcode, ST_INVALID, NULL, 0);
+	}
+}
+
+/*! Create the tag population. */
+static void field_init(const uint16_t ntags)
+{
+	struct tag_t *tag;
+	uint16_t i, j;
+
+	emu.ntags = ntags;
+
+	for (i = 0; i < ntags; i++) {
+		tag = emu.tags + i;
+		memset(tag, 0, sizeof(struct tag_t));
+		tag->epc_len = EMU_EPC;
+		tag->antenna = 1 + i % emu.antennas;
+		tag->rssi = -40 - rand() % 30;
+		tag->bank[1][2] = (EMU_EPC >> 1) << 3;
+
+		for (j = 0; j < EMU_EPC; j++)
+			tag->bank[1][4 + j] = rand();
+
+		tag->bank[1][4] = (uint8_t)(i >> 8);
+		tag->bank[1][5] = (uint8_t)(i & 0xff);
+		put16(tag->bank[1], crc16(tag->bank[1] + 2, 2 + EMU_EPC) ^ 0xffff);
+		/* TID: E2 class, serial */
+		tag->bank[2][0] = 0xe2;
+		tag->bank[2][1] = 0x00;
+		tag->bank[2][2] = 0x34;
+		tag->bank[2][3] = 0x12;
+
+		for (j = 4; j < 12; j++)
+			tag->bank[2][j] = rand();
+
+		for (j = 0; j < EMU_BANK; j++)
+			tag->bank[3][j] = j;
+	}
+}
+
+/*! Open the pty, raw, the slave is kept open to survive the
+ * client closing it.
+ */
+static int pty_open(const char *link)
+{
+	struct termios tio;
+	const char *name;
+	int fd, slave;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if ((fd < 0) || grantpt(fd) || unlockpt(fd)) {
+		perror("pty");
+		exit(EXIT_FAILURE);
+	}
+
+	name = ptsname(fd);
+	slave = open(name, O_RDWR | O_NOCTTY);
+
+	if (!tcgetattr(slave, &tio)) {
+		cfmakeraw(&tio);
+		tcsetattr(slave, TCSANOW, &tio);
+	}
+
+	if (link) {
+		unlink(link);
+
+		if (symlink(name, link))
+			perror("symlink");
+	}
+
+	printf("%s\n", name);
+	fflush(stdout);
+	return(fd);
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t buf[512];
+	const char *link;
+	uint16_t n, len;
+	ssize_t r;
+	int opt, ntags;
+
+	memset(&emu, 0, sizeof(emu));
+	emu.latency = 2;
+	emu.time_pct = 100;
+	emu.err_kind = "cdst";
+	emu.power = 3000;
+	emu.antennas = 1;
+	emu.region = 0x02;
+	ntags = 20;
+	link = NULL;
+	srand(1);
+
+	while ((opt = getopt(argc, argv, "n:a:l:b:T:e:E:s:L:v")) != -1) {
+		switch (opt) {
+		case 'n':
+			ntags = atoi(optarg);
+			break;
+		case 'a':
+			emu.antennas = atoi(optarg);
+			break;
+		case 'l':
+			emu.latency = atoi(optarg);
+			break;
+		case 'b':
+			emu.baud = strtoul(optarg, NULL, 10);
+			break;
+		case 'T':
+			emu.time_pct = atoi(optarg);
+			break;
+		case 'e':
+			emu.err_pct = atoi(optarg);
+			break;
+		case 'E':
+			emu.err_kind = optarg;
+			break;
+		case 's':
+			srand(atoi(optarg));
+			break;
+		case 'L':
+			link = optarg;
+			break;
+		case 'v':
+			emu.verbose = TRUE;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n tags] [-a antennas] "
+					"[-l msec] [-b baud] [-T pct] [-e pct] "
+					"[-E cdst] [-s seed] [-L link] [-v]\n",
+					argv[0]);
+			return(EXIT_FAILURE);
+		}
+	}
+
+	if ((ntags < 0) || (ntags > EMU_TAGS) || !emu.antennas ||
+			!*emu.err_kind) {
+		fprintf(stderr, "bad options\n");
+		return(EXIT_FAILURE);
+	}
+
+	field_init(ntags);
+	emu.fd = pty_open(link);
+	n = 0;
+
+	/* > ff [len] [opcode] [data] [crc(2)] */
+	while ((r = read(emu.fd, buf + n, sizeof(buf) - n)) > 0) {
+		n += r;
+
+		while (n) {
+			/* look for the SOH */
+			if (buf[0] != 0xff) {
+				memmove(buf, buf + 1, --n);
+				continue;
+			}
+
+			if (n < 5)
+				break;
+
+			len = buf[1] + 5;
+
+			if (n < len)
+				break;
+
+			log_frame(">", buf, len);
+
+			if (crc16(buf + 1, len - 3) == be16(buf + len - 2)) {
+				command(buf[2], buf + 3, buf[1]);
+				memmove(buf, buf + len, n - len);
+				n -= len;
+			} else {
+				/* not a frame, resync after this SOH */
+				memmove(buf, buf + 1, --n);
+			}
+		}
+	}
+
+	return(EXIT_SUCCESS);
+}
@@ -0,0 +1,468 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file m5e_log.c
+ * \brief Decode and replay the frame log of rfid_log_dump().
+ *
+ * The input is the raw capture of the debug port, the dumps are
+ * found by their "M5L" header, anything else is skipped.
+ *
+ * $ m5e_log [-p] [-t tty] [-b baud] [-q] capture
+ *
+ * Without options every frame is printed with its time and the
+ * reply latency, a summary per opcode at the end.
+ *
+ * -p replay the replies into the driver parser, rx_byte(), and
+ *    check it agrees with the log.
+ * -t replay the commands on a tty, the emulator pty or a reader,
+ *    with the recorded pauses, and compare the reply latency.
+ * -b baud rate of the tty (default 9600)
+ * -q print the summary only
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "hal.h"
+#include "rfid_m5.h"
+#include "rfid_m5_private.h"
+
+/*! Max capture size */
+#define CAPTURE_SIZE 0x100000UL
+/*! msec to wait for a replayed reply */
+#define REPLY_MSEC 2000
+
+/*! A decoded record */
+struct record {
+	uint8_t flags;
+	/*! msec from the first record of the dump */
+	uint32_t time;
+	/*! frame after the SOH */
+	const uint8_t *frame;
+	uint16_t size;
+};
+
+/*! Per opcode summary */
+struct summary {
+	uint32_t cmds;
+	uint32_t replies;
+	uint32_t bad;
+	uint32_t timeouts;
+	/*! msec, recorded and replayed */
+	uint32_t latency;
+	uint32_t replayed;
+	uint32_t replays;
+};
+
+static struct summary sum[256];
+static uint8_t quiet;
+
+static uint16_t be16(const uint8_t *p)
+{
+	return(((uint16_t)p[0] << 8) | p[1]);
+}
+
+/*! CRC of the frame from the len to the data. */
+static uint16_t crc16(const uint8_t *p, const uint16_t size)
+{
+	uint16_t crc, i;
+
+	crc = 0xffff;
+
+	for (i = 0; i < size; i++)
+		CRC_calcCrc8(&crc, p[i]);
+
+	return(crc);
+}
+
+static uint32_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec * 1000UL + ts.tv_nsec / 1000000L);
+}
+
+static void msleep(const uint32_t ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+}
+
+/*! Decode the record at p.
+ *
+ * \param last the msec of the previous record, the 16 bits time
+ * wraps every 65 sec.
+ * \return the record size, 0 if truncated.
+ */
+static uint16_t record_get(const uint8_t *p, const uint32_t left,
+		uint16_t *last, struct record *r)
+{
+	uint16_t ms;
+
+	if (left < 3)
+		return(0);
+
+	r->flags = p[0];
+	ms = be16(p + 1);
+	r->time += (uint16_t)(ms - *last);
+	*last = ms;
+	r->frame = p + 3;
+	r->size = 0;
+
+	if (!(r->flags & RFID_LOG_TIMEOUT)) {
+		if (left < 4)
+			return(0);
+
+		r->size = p[3] + ((r->flags & RFID_LOG_RX) ? 6 : 4);
+	}
+
+	if (left < (uint32_t)(r->size + 3))
+		return(0);
+
+	return(r->size + 3);
+}
+
+/*! Print a record. */
+static void record_print(const struct record *r, const uint32_t latency)
+{
+	const uint8_t *data;
+	uint16_t i, len;
+	uint8_t hdr;
+
+	if (quiet)
+		return;
+
+	printf("%9.3f ", r->time / 1000.0);
+
+	if (r->flags & RFID_LOG_TIMEOUT) {
+		printf("! timeout\n");
+		return;
+	}
+
+	len = r->frame[0];
+	hdr = (r->flags & RFID_LOG_RX) ? 4 : 2;
+	data = r->frame + hdr;
+
+	if (r->flags & RFID_LOG_RX)
+		printf("< %02x %04x", r->frame[1], be16(r->frame + 2));
+	else
+		printf("> %02x", r->frame[1]);
+
+	printf(" len %u", len);
+
+	for (i = 0; i < len; i++)
+		printf("%s%02x", i ? "" : " ", data[i]);
+
+	if (crc16(r->frame, len + hdr) != be16(r->frame + len + hdr))
+		printf(" bad-crc");
+
+	if (r->flags & RFID_LOG_RX)
+		printf(" +%ums", latency);
+
+	printf("\n");
+}
+
+/*! Open the tty raw. */
+static int tty_open(const char *path, const uint32_t baud)
+{
+	struct termios tio;
+	speed_t speed;
+	int fd;
+
+	switch (baud) {
+	case 230400:
+		speed = B230400;
+		break;
+	case 115200:
+		speed = B115200;
+		break;
+	case 57600:
+		speed = B57600;
+		break;
+	case 38400:
+		speed = B38400;
+		break;
+	case 19200:
+		speed = B19200;
+		break;
+	case 9600:
+		speed = B9600;
+		break;
+	default:
+		fprintf(stderr, "%u: baud rate not supported\n", baud);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(path, O_RDWR | O_NOCTTY);
+
+	if (fd < 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!tcgetattr(fd, &tio)) {
+		cfmakeraw(&tio);
+		tio.c_cc[VMIN] = 0;
+		tio.c_cc[VTIME] = 1;
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+
+	tcflush(fd, TCIOFLUSH);
+	return(fd);
+}
+
+/*! Send a recorded command on the tty, wait for the reply.
+ *
+ * \return the reply latency in msec, -1 timeout.
+ */
+static int32_t replay_cmd(const int fd, const struct record *r)
+{
+	uint8_t buf[300], c;
+	uint32_t t;
+
+	buf[0] = 0xff;
+	memcpy(buf + 1, r->frame, r->size);
+
+	if (write(fd, buf, r->size + 1) != (r->size + 1))
+		return(-1);
+
+	t = now_ms();
+	rx_reset();
+
+	while ((now_ms() - t) < REPLY_MSEC)
+		if ((read(fd, &c, 1) == 1) && rx_byte(c))
+			return(now_ms() - t);
+
+	return(-1);
+}
+
+/*! Feed a recorded reply to the parser.
+ *
+ * \return TRUE the parser agrees with the log.
+ */
+static uint8_t replay_parse(const struct record *r)
+{
+	uint16_t i;
+	uint8_t end;
+
+	rx_reset();
+	end = rx_byte(0xff);
+
+	for (i = 0; (i < r->size) && !end; i++)
+		end = rx_byte(r->frame[i]);
+
+	if (!end || (i != r->size))
+		return(FALSE);
+
+	return((rfid->error != RX_END) == !!(r->flags & RFID_LOG_BADCRC));
+}
+
+/*! Walk a dump.
+ *
+ * \return the bytes used.
+ */
+static uint32_t dump(const uint8_t *p, const uint32_t left,
+		const uint8_t parse, const int fd, uint32_t *mismatch)
+{
+	struct record r;
+	struct summary *s;
+	uint32_t bytes, n, size, tx, idle;
+	int32_t lat;
+	uint16_t last;
+	uint8_t op;
+
+	if ((left < 8) || (p[3] != RFID_LOG_VERSION)) {
+		fprintf(stderr, "unknown dump version\n");
+		return(4);
+	}
+
+	bytes = be16(p + 4);
+
+	if (!quiet)
+		printf("dump %u bytes, %u records lost\n", bytes, be16(p + 6));
+
+	p += 8;
+
+	if (bytes > (left - 8))
+		bytes = left - 8;
+
+	memset(&r, 0, sizeof(r));
+	last = bytes > 2 ? be16(p + 1) : 0;
+	op = 0;
+	tx = 0;
+	idle = 0;
+
+	for (n = 0; n < bytes; n += size) {
+		size = record_get(p + n, bytes - n, &last, &r);
+
+		if (!size) {
+			fprintf(stderr, "truncated record at %u\n", n);
+			break;
+		}
+
+		if (r.flags & RFID_LOG_TIMEOUT) {
+			sum[op].timeouts++;
+			record_print(&r, 0);
+			idle = r.time;
+			continue;
+		}
+
+		op = r.frame[1];
+		s = sum + op;
+
+		if (!(r.flags & RFID_LOG_RX)) {
+			s->cmds++;
+			record_print(&r, 0);
+
+			if (fd >= 0) {
+				/* the pause before the command */
+				if (r.time > idle)
+					msleep(r.time - idle);
+
+				lat = replay_cmd(fd, &r);
+
+				if (lat >= 0) {
+					s->replayed += lat;
+					s->replays++;
+				}
+			}
+
+			tx = r.time;
+			continue;
+		}
+
+		s->replies++;
+		s->latency += r.time - tx;
+		idle = r.time;
+
+		if (r.flags & RFID_LOG_BADCRC)
+			s->bad++;
+
+		record_print(&r, r.time - tx);
+
+		if (parse && !replay_parse(&r)) {
+			(*mismatch)++;
+			printf("parser mismatch at %.3f\n", r.time / 1000.0);
+		}
+	}
+
+	return(bytes + 8);
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *cap, parse;
+	uint32_t size, n, mismatch, baud;
+	const char *tty;
+	FILE *f;
+	int opt, fd, i;
+
+	parse = FALSE;
+	tty = NULL;
+	baud = 9600;
+	quiet = FALSE;
+
+	while ((opt = getopt(argc, argv, "pt:b:q")) != -1) {
+		switch (opt) {
+		case 'p':
+			parse = TRUE;
+			break;
+		case 't':
+			tty = optarg;
+			break;
+		case 'b':
+			baud = strtoul(optarg, NULL, 10);
+			break;
+		case 'q':
+			quiet = TRUE;
+			break;
+		default:
+			optind = argc;
+		}
+	}
+
+	if (optind != (argc - 1)) {
+		fprintf(stderr, "usage: %s [-p] [-t tty] [-b baud] [-q] "
+				"capture\n", argv[0]);
+		return(EXIT_FAILURE);
+	}
+
+	f = fopen(argv[optind], "rb");
+
+	if (!f) {
+		perror(argv[optind]);
+		return(EXIT_FAILURE);
+	}
+
+	cap = malloc(CAPTURE_SIZE);
+	size = fread(cap, 1, CAPTURE_SIZE, f);
+	fclose(f);
+	rfid = malloc(sizeof(struct rfid_t));
+	rfid->data = malloc(RFID_BUFFER_SIZE);
+	fd = tty ? tty_open(tty, baud) : -1;
+	mismatch = 0;
+
+	for (n = 0; (n + 3) < size;)
+		if (!memcmp(cap + n, "M5L", 3))
+			n += dump(cap + n, size - n, parse, fd, &mismatch);
+		else
+			n++;
+
+	printf("op  cmds replies bad timeouts latency(ms)%s\n",
+			fd >= 0 ? " replayed(ms)" : "");
+
+	for (i = 0; i < 256; i++) {
+		if (!sum[i].cmds && !sum[i].replies)
+			continue;
+
+		printf("%02x %5u %7u %3u %8u %11.1f", i, sum[i].cmds,
+				sum[i].replies, sum[i].bad, sum[i].timeouts,
+				sum[i].replies ?
+				(double)sum[i].latency / sum[i].replies : 0);
+
+		if (fd >= 0)
+			printf(" %12.1f", sum[i].replays ?
+					(double)sum[i].replayed / sum[i].replays : 0);
+
+		printf("\n");
+	}
+
+	if (parse)
+		printf("parser mismatches %u\n", mismatch);
+
+	if (fd >= 0)
+		close(fd);
+
+	free(rfid->data);
+	free(rfid);
+	free(cap);
+	return(mismatch ? EXIT_FAILURE : EXIT_SUCCESS);
+}
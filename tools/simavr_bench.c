@@ -0,0 +1,317 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file simavr_bench.c
+ * \brief Run bench/avr_bench.c on simavr.
+ *
+ * $ simavr_bench [-m mcu] [-f hz] [-i vector] [-p pty] firmware.elf
+ *
+ * The firmware output on USART0 is copied to stdout. USART1 is
+ * the reader: with -p the bytes go to the M5e emulator on the pty,
+ * otherwise a canned peer replies to every frame with status 0.
+ *
+ * The harness steps the core one instruction at a time and adds:
+ * - avr_isr_rx: cycles from the rx vector to its reti, average
+ *   and max (the vector jump itself excluded).
+ * - avr_stack_peak: bytes between RAMEND and the lowest SP.
+ * - avr_total: cycles of the whole run.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/avr_uart.h>
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+/*! Bytes to the firmware waiting for the uart */
+static uint8_t rxq[4096];
+static uint16_t rxh, rxt;
+static uint8_t xon = TRUE;
+
+/*! Frame from the firmware to the canned peer */
+static uint8_t frame[262];
+static uint16_t flen;
+
+/*! The emulator pty, -1 canned peer */
+static int peer = -1;
+
+static uint16_t crc16(const uint8_t *p, const uint16_t size)
+{
+	uint16_t crc, i;
+	uint8_t bit;
+
+	crc = 0xffff;
+
+	for (i = 0; i < size; i++)
+		for (bit = 0x80; bit; bit >>= 1) {
+			if (crc & 0x8000)
+				crc = ((crc << 1) | !!(p[i] & bit)) ^ 0x1021;
+			else
+				crc = (crc << 1) | !!(p[i] & bit);
+		}
+
+	return(crc);
+}
+
+static void rx_put(const uint8_t c)
+{
+	rxq[rxt++ % sizeof(rxq)] = c;
+}
+
+/*! Canned reply: status 0, an EPC for 21h, 1 tag for 22h. */
+static void canned(const uint8_t opcode)
+{
+	uint8_t r[32];
+	uint16_t crc;
+	uint8_t len, i;
+
+	len = 0;
+
+	if (opcode == 0x21) {
+		len = 12;
+
+		for (i = 0; i < len; i++)
+			r[5 + i] = 0xe0 + i;
+	} else if (opcode == 0x22) {
+		len = 4;
+		memset(r + 5, 0, 3);
+		r[8] = 1;
+	}
+
+	r[0] = 0xff;
+	r[1] = len;
+	r[2] = opcode;
+	r[3] = 0;
+	r[4] = 0;
+	crc = crc16(r + 1, len + 4);
+	r[5 + len] = (uint8_t)(crc >> 8);
+	r[6 + len] = (uint8_t)(crc & 0xff);
+
+	for (i = 0; i < (len + 7); i++)
+		rx_put(r[i]);
+}
+
+/*! A byte from the firmware USART0, the results. */
+static void out0(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void)irq;
+	(void)param;
+
+	if (value != '\r')
+		putchar(value);
+}
+
+/*! A byte from the firmware USART1, to the reader. */
+static void out1(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	uint8_t c;
+
+	(void)irq;
+	(void)param;
+	c = value;
+
+	if (peer >= 0) {
+		if (write(peer, &c, 1) != 1)
+			perror("peer");
+
+		return;
+	}
+
+	if (!flen && (c != 0xff))
+		return;
+
+	frame[flen++] = c;
+
+	if ((flen >= 5) && (flen == (frame[1] + 5))) {
+		canned(frame[2]);
+		flen = 0;
+	}
+}
+
+static void xon1(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void)irq;
+	(void)value;
+	(void)param;
+	xon = TRUE;
+}
+
+static void xoff1(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void)irq;
+	(void)value;
+	(void)param;
+	xon = FALSE;
+}
+
+/*! Disable the simavr uart echo on the terminal. */
+static void uart_quiet(avr_t *avr, const char name)
+{
+	uint32_t f;
+
+	f = 0;
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS(name), &f);
+	f &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS(name), &f);
+}
+
+int main(int argc, char **argv)
+{
+	elf_firmware_t fw;
+	avr_t *avr;
+	avr_irq_t *in1;
+	avr_cycle_count_t start, isr_start, isr_sum, isr_max;
+	uint32_t isr_count, steps;
+	uint16_t sp, sp_min, sp_ret, vector;
+	const char *mcu;
+	uint32_t freq;
+	uint8_t in_isr, c;
+	int opt, state;
+
+	mcu = "atmega1284p";
+	freq = 1000000;
+	/* USART1_RX of the atmega1284p */
+	vector = 28;
+
+	while ((opt = getopt(argc, argv, "m:f:i:p:")) != -1) {
+		switch (opt) {
+		case 'm':
+			mcu = optarg;
+			break;
+		case 'f':
+			freq = strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			vector = atoi(optarg);
+			break;
+		case 'p':
+			peer = open(optarg, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+			if (peer < 0) {
+				perror(optarg);
+				return(EXIT_FAILURE);
+			}
+
+			break;
+		default:
+			optind = argc;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-m mcu] [-f hz] [-i vector] "
+				"[-p pty] firmware.elf\n", argv[0]);
+		return(EXIT_FAILURE);
+	}
+
+	memset(&fw, 0, sizeof(fw));
+
+	if (elf_read_firmware(argv[optind], &fw)) {
+		fprintf(stderr, "cannot load %s\n", argv[optind]);
+		return(EXIT_FAILURE);
+	}
+
+	avr = avr_make_mcu_by_name(fw.mmcu[0] ? fw.mmcu : mcu);
+
+	if (!avr) {
+		fprintf(stderr, "unknown mcu %s\n", mcu);
+		return(EXIT_FAILURE);
+	}
+
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->frequency = fw.frequency ? fw.frequency : freq;
+
+	uart_quiet(avr, '0');
+	uart_quiet(avr, '1');
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+				UART_IRQ_OUTPUT), out0, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('1'),
+				UART_IRQ_OUTPUT), out1, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('1'),
+				UART_IRQ_OUT_XON), xon1, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('1'),
+				UART_IRQ_OUT_XOFF), xoff1, NULL);
+	in1 = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('1'), UART_IRQ_INPUT);
+
+	start = avr->cycle;
+	sp_min = avr->ramend;
+	sp_ret = 0;
+	isr_start = 0;
+	isr_sum = 0;
+	isr_max = 0;
+	isr_count = 0;
+	in_isr = FALSE;
+	steps = 0;
+	state = cpu_Running;
+
+	while ((state != cpu_Done) && (state != cpu_Crashed)) {
+		state = avr_run(avr);
+		sp = avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+
+		if (sp < sp_min)
+			sp_min = sp;
+
+		if (!in_isr && (avr->pc == (avr_flashaddr_t)vector *
+					avr->vector_size)) {
+			in_isr = TRUE;
+			isr_start = avr->cycle;
+			/* the return address is on the stack */
+			sp_ret = sp + avr->address_size;
+		} else if (in_isr && (sp == sp_ret)) {
+			in_isr = FALSE;
+			isr_count++;
+			isr_sum += avr->cycle - isr_start;
+
+			if ((avr->cycle - isr_start) > isr_max)
+				isr_max = avr->cycle - isr_start;
+		}
+
+		/* the peer, checked every few instructions */
+		if (!(++steps & 0xff)) {
+			while ((peer >= 0) && (read(peer, &c, 1) == 1))
+				rx_put(c);
+
+			while (xon && (rxh != rxt))
+				avr_raise_irq(in1, rxq[rxh++ % sizeof(rxq)]);
+		}
+	}
+
+	if (isr_count) {
+		printf("bench avr_isr_rx %llu cycles\n",
+				(unsigned long long)(isr_sum / isr_count));
+		printf("bench avr_isr_rx_max %llu cycles\n",
+				(unsigned long long)isr_max);
+	}
+
+	printf("bench avr_isr_rx_count %u irq\n", isr_count);
+	printf("bench avr_stack_peak %u bytes\n", avr->ramend - sp_min);
+	printf("bench avr_total %llu cycles\n",
+			(unsigned long long)(avr->cycle - start));
+	return((state == cpu_Crashed) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
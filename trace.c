@@ -0,0 +1,88 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "trace.h"
+#include "usart.h"
+
+#ifdef USE_TRACE
+
+#ifndef HAL_POSIX
+#include <util/atomic.h>
+#endif
+
+/*! The main and the ISR rings */
+volatile struct trace_ring_t trace_ring[2];
+
+/*! Clear the rings. */
+void trace_clear(void)
+{
+	memset((void *)trace_ring, 0, sizeof(trace_ring));
+}
+
+/*! Print a byte in hex. */
+static void hex(const uint8_t port, const uint8_t c)
+{
+	usart_putchar(port, "0123456789abcdef"[c >> 4]);
+	usart_putchar(port, "0123456789abcdef"[c & 0x0f]);
+}
+
+/*! Dump the rings on a serial port, then clear them.
+ *
+ * The rings are copied first, the tracepoints hit while
+ * printing are not in the dump. A line every record, the oldest
+ * first:
+ *
+ * [m|i] [id] [ticks(4)]
+ *
+ * m the main ring, i the ISR one, in hex.
+ *
+ * \param port the serial port, usually the debug one.
+ */
+void trace_dump(const uint8_t port)
+{
+	struct trace_ring_t copy[2];
+	struct trace_rec_t *rec;
+	uint8_t i, j;
+
+#ifdef HAL_POSIX
+	memcpy(copy, (void *)trace_ring, sizeof(copy));
+	trace_clear();
+#else
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		memcpy(copy, (void *)trace_ring, sizeof(copy));
+		trace_clear();
+	}
+#endif
+
+	for (i = 0; i < 2; i++)
+		for (j = 0; j < copy[i].len; j++) {
+			rec = copy[i].rec + ((copy[i].head - copy[i].len + j) &
+					(TRACE_SIZE - 1));
+			usart_putchar(port, i ? 'i' : 'm');
+			usart_putchar(port, ' ');
+			hex(port, rec->id);
+			usart_putchar(port, ' ');
+			hex(port, (uint8_t)(rec->ticks >> 8));
+			hex(port, (uint8_t)(rec->ticks & 0xff));
+			usart_printstr(port, "\r\n");
+		}
+}
+
+#endif /* USE_TRACE */
@@ -0,0 +1,122 @@
+/* Copyright (C) 2016 Enrico Rossi
+
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*! \file trace.h
+ * \brief Compile time tracepoints.
+ *
+ * -D USE_TRACE
+ * -D TRACE_SIZE=32
+ *
+ * TRACE(id) records the id and hal_ticks() in RAM, without
+ * USE_TRACE it expands to nothing.
+ *
+ * There are two rings of TRACE_SIZE records, one written with the
+ * interrupts enabled, the main context, one with the interrupts
+ * disabled, the ISRs. Every ring has a single writer which can not
+ * be preempted by another writer of the same ring, no lock is
+ * needed. The oldest records are overwritten.
+ *
+ * \warning an ISR which enables the interrupts writes the main
+ * ring, do not trace it.
+ * \see trace_dump()
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "hal.h"
+
+/*! Tracepoint ids, from 0x80 free for the application */
+#define TRACE_CBUF_PUSH 0x01
+#define TRACE_CBUF_OVR 0x02
+#define TRACE_USART0_RX 0x10
+#define TRACE_USART1_RX 0x11
+#define TRACE_USART0_TX 0x12
+#define TRACE_USART1_TX 0x13
+#define TRACE_CMD_SEND 0x20
+#define TRACE_CMD_OK 0x21
+#define TRACE_CMD_FAIL 0x22
+#define TRACE_INV_START 0x30
+#define TRACE_INV_END 0x31
+#define TRACE_INV_TAG 0x32
+
+#ifdef USE_TRACE
+
+/*! Records of a ring, a power of 2 up to 128 */
+#ifndef TRACE_SIZE
+#define TRACE_SIZE 32
+#endif
+
+#if (TRACE_SIZE & (TRACE_SIZE - 1)) || (TRACE_SIZE > 128)
+#error TRACE_SIZE must be a power of 2 up to 128
+#endif
+
+#define TRACE_MAIN 0
+#define TRACE_ISR 1
+
+/*! The ring of the running context */
+#ifdef HAL_POSIX
+#define TRACE_CONTEXT() TRACE_MAIN
+#else
+#define TRACE_CONTEXT() (bit_is_clear(SREG, SREG_I) ? TRACE_ISR : TRACE_MAIN)
+#endif
+
+struct trace_rec_t {
+	uint8_t id;
+	uint16_t ticks;
+};
+
+struct trace_ring_t {
+	/*! next record to write */
+	uint8_t head;
+	/*! records written, up to TRACE_SIZE */
+	uint8_t len;
+	struct trace_rec_t rec[TRACE_SIZE];
+};
+
+extern volatile struct trace_ring_t trace_ring[2];
+
+/*! Record a tracepoint. */
+static inline void trace_put(const uint8_t id)
+{
+	volatile struct trace_ring_t *ring;
+	uint8_t i;
+
+	ring = trace_ring + TRACE_CONTEXT();
+	i = ring->head;
+	ring->rec[i].id = id;
+	ring->rec[i].ticks = hal_ticks();
+	ring->head = (i + 1) & (TRACE_SIZE - 1);
+
+	if (ring->len < TRACE_SIZE)
+		ring->len++;
+}
+
+#define TRACE(id) trace_put(id)
+
+void trace_clear(void);
+void trace_dump(const uint8_t port);
+
+#else
+
+#define TRACE(id)
+
+#endif /* USE_TRACE */
+
+#endif
@@ -23,6 +23,13 @@
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include "usart.h"
+#include "trace.h"
+
+volatile struct usart_t *usart0;
+
+#ifdef USE_USART1
+volatile struct usart_t *usart1;
+#endif
 
 /*! \brief Interrupt rx.
  *
@@ -36,6 +43,7 @@ ISR(USART0_RX_vect)
 {
 	uint8_t rxc;
 
+	TRACE(TRACE_USART0_RX);
 	/*! First copy the rx char from the device rx buffer. */
 	rxc = UDR0;
 
@@ -53,6 +61,7 @@ ISR(USART1_RX_vect)
 {
 	uint8_t rxc;
 
+	TRACE(TRACE_USART1_RX);
 	/*! First copy the rx char from the device rx buffer. */
 	rxc = UDR1;
 
@@ -345,15 +354,42 @@ void usart_putchar(const uint8_t port, const uint8_t c)
 
 #ifdef USE_USART1
 		loop_until_bit_is_set(UCSR1A, UDRE1);
+		TRACE(TRACE_USART1_TX);
 		UDR1 = c;
 #endif /* USE_USART1 */
 
 	} else {
 		loop_until_bit_is_set(UCSR0A, UDRE0);
+		TRACE(TRACE_USART0_TX);
 		UDR0 = c;
 	}
 }
 
+/*! Check if the USART Tx holding register is empty.
+ *
+ * Used to send data without blocking, if TRUE then the next
+ * usart_putchar() does not wait.
+ *
+ * \parameter port the serial port.
+ * \return TRUE the port is ready to accept a char.
+ */
+uint8_t usart_txready(const uint8_t port)
+{
+	if (port) {
+
+#ifdef USE_USART1
+		if (bit_is_set(UCSR1A, UDRE1))
+			return(TRUE);
+#endif /* USE_USART1 */
+
+	} else {
+		if (bit_is_set(UCSR0A, UDRE0))
+			return(TRUE);
+	}
+
+	return(FALSE);
+}
+
 /*! Send a C (NUL-terminated) string down the USART Tx.
  *
  * If the string passed is NULL, then print the TX buffer of the
@@ -30,6 +30,12 @@
  *
  *  Tx buffer size
  * -D USARTn_TXBUF_SIZE=16
+ *
+ *  POSIX host, the serial device and its speed
+ * -D HAL_POSIX
+ * -D USARTn_DEV=\"/dev/ttyUSB0\"
+ * -D USARTn_BAUD=9600
+ * -D USART_TXQ_SIZE=512
  */
 
 #ifndef _USART_H_
@@ -102,10 +108,10 @@ struct usart_t {
 };
 
 /*! Global USART rxtx buffers pointer used inside the ISR routine. */
-volatile struct usart_t *usart0;
+extern volatile struct usart_t *usart0;
 
 #ifdef USE_USART1
-volatile struct usart_t *usart1;
+extern volatile struct usart_t *usart1;
 #endif
 
 void usart_resume(const uint8_t port);
@@ -114,9 +120,19 @@ volatile struct usart_t *usart_init(uint8_t port);
 void usart_shut(uint8_t port);
 char usart_getchar(const uint8_t port, const uint8_t locked);
 void usart_putchar(const uint8_t port, const uint8_t c);
+uint8_t usart_txready(const uint8_t port);
 void usart_printstr(const uint8_t port, const char *s);
 uint8_t usart_get(const uint8_t port, uint8_t *s, const uint8_t size);
 uint8_t usart_getmsg(const uint8_t port, uint8_t *s, const uint8_t size);
 void usart_clear_rx_buffer(const uint8_t port);
 
+#ifdef HAL_POSIX
+uint8_t usart_device(const uint8_t port, const char *path,
+		const uint32_t baud);
+void usart_flush(const uint8_t port);
+#else
+/*! usart_putchar() writes the data register, nothing is queued */
+#define usart_flush(port)
+#endif
+
 #endif
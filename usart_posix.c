@@ -0,0 +1,489 @@
+/*
+    USART - Serial port library, POSIX backend.
+    Copyright (C) 2005-2016 Enrico Rossi
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA  02110-1301  USA
+ */
+
+/*! \file usart_posix.c
+ * \brief The usart.h interface on a termios tty.
+ *
+ * The device is opened non-blocking in raw 8n1 mode, the bytes
+ * waiting in the tty are moved to the rx circular buffer by every
+ * read call, in place of the rx ISR.
+ *
+ * The chars sent are queued and written with a single write() by
+ * usart_flush(), which is also done before every read, at the end
+ * of usart_printstr() and when the queue is full.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "usart.h"
+#include "trace.h"
+
+#ifndef USART0_DEV
+#define USART0_DEV "/dev/ttyUSB0"
+#endif
+
+#ifndef USART1_DEV
+#define USART1_DEV "/dev/ttyUSB1"
+#endif
+
+#ifndef USART0_BAUD
+#define USART0_BAUD 9600
+#endif
+
+#ifndef USART1_BAUD
+#define USART1_BAUD 9600
+#endif
+
+/*! The baud rates of speed_of() */
+#define BAUD_OK(bps) (((bps) == 9600) || ((bps) == 19200) || \
+		((bps) == 38400) || ((bps) == 57600) || ((bps) == 115200) || \
+		((bps) == 230400))
+
+#if !BAUD_OK(USART0_BAUD)
+#error USART0_BAUD not supported
+#endif
+
+#if !BAUD_OK(USART1_BAUD)
+#error USART1_BAUD not supported
+#endif
+
+/*! Tx queue of a port, a whole M5e frame fits */
+#ifndef USART_TXQ_SIZE
+#define USART_TXQ_SIZE 512
+#endif
+
+volatile struct usart_t *usart0;
+
+#ifdef USE_USART1
+volatile struct usart_t *usart1;
+#endif
+
+/*! tty of every port, -1 closed */
+static int fd[2] = { -1, -1 };
+static const char *dev[2] = { USART0_DEV, USART1_DEV };
+static uint32_t baud[2] = { USART0_BAUD, USART1_BAUD };
+
+/*! chars sent and not yet written to the tty */
+static uint8_t txq[2][USART_TXQ_SIZE];
+static uint16_t txq_len[2];
+
+/*! The usart struct of the port, NULL if not in use. */
+static volatile struct usart_t *usart_of(const uint8_t port)
+{
+	if (port) {
+
+#ifdef USE_USART1
+		return(usart1);
+#else
+		return(NULL);
+#endif /* USE_USART1 */
+
+	} else {
+		return(usart0);
+	}
+}
+
+/*! termios speed of a baud rate, B0 if not supported. */
+static speed_t speed_of(const uint32_t bps)
+{
+	switch (bps) {
+	case 9600:
+		return(B9600);
+	case 19200:
+		return(B19200);
+	case 38400:
+		return(B38400);
+	case 57600:
+		return(B57600);
+	case 115200:
+		return(B115200);
+	case 230400:
+		return(B230400);
+	default:
+		return(B0);
+	}
+}
+
+/*! Write the tx queue to the tty.
+ *
+ * On a write error the queue is dropped.
+ *
+ * \param port the serial port number.
+ * \param wait TRUE until the whole queue is written, FALSE only
+ * what the tty accepts now.
+ */
+static void tx_write(const uint8_t port, const uint8_t wait)
+{
+	struct pollfd pfd;
+	uint16_t i;
+	ssize_t n;
+
+	pfd.fd = fd[port];
+	pfd.events = POLLOUT;
+	i = 0;
+
+	while ((fd[port] >= 0) && (i < txq_len[port])) {
+		n = write(fd[port], txq[port] + i, txq_len[port] - i);
+
+		if (n > 0)
+			i += n;
+		else if ((n < 0) && (errno != EAGAIN) && (errno != EINTR))
+			i = txq_len[port];
+		else if (wait)
+			poll(&pfd, 1, -1);
+		else
+			break;
+	}
+
+	txq_len[port] -= i;
+	memmove(txq[port], txq[port] + i, txq_len[port]);
+}
+
+/*! Write the chars queued by usart_putchar(), wait until the tty
+ * accepts them all.
+ *
+ * \param port the serial port number.
+ */
+void usart_flush(const uint8_t port)
+{
+	if (txq_len[port])
+		tx_write(port, TRUE);
+}
+
+/*! Move the bytes waiting in the tty to the rx buffer.
+ *
+ * Only the free space of the buffer is read, the rest waits in
+ * the tty instead of being lost.
+ */
+static void rx_poll(const uint8_t port)
+{
+	volatile struct usart_t *usart;
+	uint8_t buf[256];
+	ssize_t n, i;
+
+	usart = usart_of(port);
+
+	if (!usart || (fd[port] < 0))
+		return;
+
+	/* the reply follows the command */
+	usart_flush(port);
+
+	if (usart->rx->overflow)
+		return;
+
+	n = read(fd[port], buf, usart->rx->size - usart->rx->len);
+
+	for (i = 0; i < n; i++) {
+		TRACE(port ? TRACE_USART1_RX : TRACE_USART0_RX);
+
+#if defined (USART0_EOL) || defined (USART1_EOL)
+		if ((!port && (buf[i] == USART0_EOL)) ||
+				(port && (buf[i] == USART1_EOL)))
+			usart->flags.eol++;
+#endif
+
+		cbuffer_push(usart->rx, buf[i]);
+	}
+}
+
+/*! Set the device of a port.
+ *
+ * Must be called before usart_resume().
+ *
+ * \param port the serial port number.
+ * \param path the tty, e.g. /dev/ttyUSB0.
+ * \param bps the baud rate, 9600 to 230400.
+ * \return FALSE the baud rate is not supported, nothing is set.
+ */
+uint8_t usart_device(const uint8_t port, const char *path,
+		const uint32_t bps)
+{
+	if (speed_of(bps) == B0)
+		return(FALSE);
+
+	dev[port ? 1 : 0] = path;
+	baud[port ? 1 : 0] = bps;
+	return(TRUE);
+}
+
+/*! Open the tty, raw 8n1 non-blocking.
+ *
+ * \parameters port the serial port number.
+ */
+void usart_resume(const uint8_t port)
+{
+	volatile struct usart_t *usart;
+	struct termios tio;
+
+	usart = usart_of(port);
+
+	if (!usart)
+		return;
+
+	cbuffer_clear(usart->rx);
+	usart->flags.all = 0;
+	usart->tx[0] = 0;
+	txq_len[port] = 0;
+
+	if (fd[port] < 0)
+		fd[port] = open(dev[port], O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+	if (fd[port] < 0)
+		return;
+
+	if (!tcgetattr(fd[port], &tio)) {
+		cfmakeraw(&tio);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tio.c_cc[VMIN] = 0;
+		tio.c_cc[VTIME] = 0;
+		cfsetispeed(&tio, speed_of(baud[port]));
+		cfsetospeed(&tio, speed_of(baud[port]));
+		tcsetattr(fd[port], TCSANOW, &tio);
+	}
+
+	tcflush(fd[port], TCIOFLUSH);
+}
+
+/*! Write the tx queue and close the tty. */
+void usart_suspend(const uint8_t port)
+{
+	if (fd[port] >= 0) {
+		usart_flush(port);
+		close(fd[port]);
+		fd[port] = -1;
+	}
+}
+
+/*! Init the usart port.
+ *
+ * Allocates the global usart pointer.
+ *
+ * \note does NOT open the port(s).
+ */
+volatile struct usart_t *usart_init(const uint8_t port)
+{
+	if (port) {
+
+#ifdef USE_USART1
+		if (!usart1) {
+			usart1 = malloc(sizeof(struct usart_t));
+			usart1->rx = cbuffer_init();
+			usart1->tx = malloc(USART1_TXBUF_SIZE);
+			usart1->tx_size = USART1_TXBUF_SIZE;
+		}
+
+		return(usart1);
+#else
+		return(NULL);
+#endif /* USE_USART1 */
+
+	} else {
+		if (!usart0) {
+			usart0 = malloc(sizeof(struct usart_t));
+			usart0->rx = cbuffer_init();
+			usart0->tx = malloc(USART0_TXBUF_SIZE);
+			usart0->tx_size = USART0_TXBUF_SIZE;
+		}
+
+		return(usart0);
+	}
+}
+
+/*! Deallocate the usart port struct.
+ */
+void usart_shut(uint8_t port)
+{
+	volatile struct usart_t *usart;
+
+	usart_suspend(port);
+	usart = usart_of(port);
+
+	if (usart) {
+		cbuffer_shut(usart->rx);
+		free(usart->tx);
+		free((void *)usart);
+	}
+
+	if (port) {
+
+#ifdef USE_USART1
+		usart1 = NULL;
+#endif /* USE_USART1 */
+
+	} else {
+		usart0 = NULL;
+	}
+}
+
+/*! Get a char directly from the tty, bypassing the rx buffer. */
+char usart_getchar(const uint8_t port, const uint8_t locked)
+{
+	struct pollfd pfd;
+	uint8_t c;
+
+	if (fd[port] < 0)
+		return(FALSE);
+
+	usart_flush(port);
+	pfd.fd = fd[port];
+	pfd.events = POLLIN;
+
+	if (poll(&pfd, 1, locked ? -1 : 0) < 1)
+		return(FALSE);
+
+	if (read(fd[port], &c, 1) != 1)
+		return(FALSE);
+
+	return(c);
+}
+
+void usart_clear_rx_buffer(const uint8_t port)
+{
+	volatile struct usart_t *usart;
+
+	usart = usart_of(port);
+
+	if (!usart)
+		return;
+
+	if (fd[port] >= 0)
+		tcflush(fd[port], TCIFLUSH);
+
+	usart->flags.eol = 0;
+	cbuffer_clear(usart->rx);
+}
+
+/*! get the RX buffer of a given maxsize.
+ *
+ * \param port the serial port.
+ * \param s the area to copy the message to.
+ * \param size the sizeof(s).
+ * \note s must have the allocated size.
+ */
+uint8_t usart_get(const uint8_t port, uint8_t *s, const uint8_t size)
+{
+	volatile struct usart_t *usart;
+
+	usart = usart_of(port);
+
+	if (!usart)
+		return(0);
+
+	rx_poll(port);
+	return(cbuffer_pop(usart->rx, s, size));
+}
+
+/*! get the message from the RX buffer of a given maxsize.
+ *
+ * \see usart.c
+ */
+uint8_t usart_getmsg(const uint8_t port, uint8_t *s, const uint8_t size)
+{
+	volatile struct usart_t *usart;
+	uint8_t ok;
+
+	usart = usart_of(port);
+	ok = 0;
+
+	if (!usart)
+		return(ok);
+
+	rx_poll(port);
+
+	if (port) {
+
+#if defined (USE_USART1) && defined (USART1_EOL)
+		ok = cbuffer_popm(usart->rx, s, size, USART1_EOL);
+#endif
+
+	} else {
+
+#if defined (USART0_EOL)
+		ok = cbuffer_popm(usart->rx, s, size, USART0_EOL);
+#endif
+	}
+
+	if (ok && usart->flags.eol)
+		usart->flags.eol--;
+
+	return(ok);
+}
+
+/*! Queue character c for the tty, wait only if the queue is full.
+ *
+ * \parameter port the serial port.
+ * \parameter c the char to send.
+ * \see usart_flush()
+ */
+void usart_putchar(const uint8_t port, const uint8_t c)
+{
+	if (fd[port] < 0)
+		return;
+
+	TRACE(port ? TRACE_USART1_TX : TRACE_USART0_TX);
+
+	if (txq_len[port] == USART_TXQ_SIZE)
+		tx_write(port, TRUE);
+
+	txq[port][txq_len[port]++] = c;
+}
+
+/*! Check if a char can be queued without waiting.
+ *
+ * \parameter port the serial port.
+ * \return TRUE the port is ready to accept a char.
+ */
+uint8_t usart_txready(const uint8_t port)
+{
+	if (fd[port] < 0)
+		return(FALSE);
+
+	if (txq_len[port] == USART_TXQ_SIZE)
+		tx_write(port, FALSE);
+
+	return(txq_len[port] < USART_TXQ_SIZE);
+}
+
+/*! Send a C (NUL-terminated) string down the tty.
+ *
+ * \see usart.c
+ */
+void usart_printstr(const uint8_t port, const char *s)
+{
+	volatile struct usart_t *usart;
+
+	usart = usart_of(port);
+
+	if (!s && usart)
+		s = usart->tx;
+
+	while (s && *s)
+		usart_putchar(port, *s++);
+
+	usart_flush(port);
+}